@@ -0,0 +1,270 @@
+#include "array.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "value.h"
+
+// the kernels work on as many lanes as the target has (AVX when
+// the compiler is told to use it, e.g. with -mavx, and SSE2 on
+// any x86-64), with a scalar loop for the rest of the elements
+#if defined(__AVX__)
+#include <immintrin.h>
+#define ARRAY_LANES 4
+typedef __m256d lanes;
+#define lanes_load _mm256_loadu_pd
+#define lanes_store _mm256_storeu_pd
+#define lanes_set _mm256_set1_pd
+#define lanes_add _mm256_add_pd
+#define lanes_subtract _mm256_sub_pd
+#define lanes_multiply _mm256_mul_pd
+#define lanes_divide _mm256_div_pd
+#define lanes_min _mm256_min_pd
+#define lanes_max _mm256_max_pd
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ARRAY_LANES 2
+typedef __m128d lanes;
+#define lanes_load _mm_loadu_pd
+#define lanes_store _mm_storeu_pd
+#define lanes_set _mm_set1_pd
+#define lanes_add _mm_add_pd
+#define lanes_subtract _mm_sub_pd
+#define lanes_multiply _mm_mul_pd
+#define lanes_divide _mm_div_pd
+#define lanes_min _mm_min_pd
+#define lanes_max _mm_max_pd
+#endif
+
+#ifdef ARRAY_LANES
+#define LANES_LOOP(i, length, ...)                               \
+    for (; i + ARRAY_LANES <= length; i += ARRAY_LANES) {        \
+        __VA_ARGS__;                                             \
+    }
+#else
+#define LANES_LOOP(i, length, ...)
+#endif
+
+// the buffers are aligned for the widest loads, although
+// the slices may start anywhere in them
+#define ARRAY_ALIGNMENT 32
+
+// the longer arrays are printed with the first elements only
+#define ARRAY_PRINT_LIMIT 16
+
+struct array_buffer {
+    double* data;
+    size_t num_refs;
+};
+
+static value* array_new_view(array_buffer* buffer, double* data, size_t length) {
+    value_array* a = malloc(sizeof(value_array));
+    a->buffer = buffer;
+    a->data = data;
+    a->length = length;
+
+    return value_new_array(a);
+}
+
+value* array_new(size_t length) {
+    if (length > SIZE_MAX / sizeof(double)) {
+        return NULL;
+    }
+
+    array_buffer* buffer = malloc(sizeof(array_buffer));
+    size_t size = ((length > 0) ? length : 1) * sizeof(double);
+    if (posix_memalign((void**)&buffer->data, ARRAY_ALIGNMENT, size) != 0) {
+        free(buffer);
+        return NULL;
+    }
+    buffer->num_refs = 1;
+
+    return array_new_view(buffer, buffer->data, length);
+}
+
+value* array_slice(value_array* a, size_t start, size_t end) {
+    __sync_fetch_and_add(&a->buffer->num_refs, 1);
+
+    return array_new_view(a->buffer, a->data + start, end - start);
+}
+
+void array_release(value_array* a) {
+    if (__sync_sub_and_fetch(&a->buffer->num_refs, 1) == 0) {
+        free(a->buffer->data);
+        free(a->buffer);
+    }
+    free(a);
+}
+
+int array_to_str(value_array* a, char* buffer) {
+    char* running = buffer;
+
+    running += sprintf(running, "[");
+    for (size_t i = 0; i < a->length && i < ARRAY_PRINT_LIMIT; i++) {
+        running += sprintf(running, (i > 0) ? " %g" : "%g", a->data[i]);
+    }
+    if (a->length > ARRAY_PRINT_LIMIT) {
+        running += sprintf(running, " ...");
+    }
+    running += sprintf(running, "]");
+
+    return running - buffer;
+}
+
+void array_print(value_array* a, FILE* stream) {
+    char buffer[ARRAY_PRINT_LIMIT * 32];
+    array_to_str(a, buffer);
+    fputs(buffer, stream);
+}
+
+#define ELEMENTWISE_KERNELS(name, lanes_op, op)                                              \
+    static void name(double* out, double* a, double* b, size_t length) {                   \
+        size_t i = 0;                                                                      \
+        LANES_LOOP(i, length,                                                              \
+                   lanes_store(out + i, lanes_op(lanes_load(a + i), lanes_load(b + i)))); \
+        for (; i < length; i++) {                                                          \
+            out[i] = a[i] op b[i];                                                         \
+        }                                                                                  \
+    }                                                                                      \
+                                                                                           \
+    static void name##_scalar(double* out, double* a, double b, size_t length) {           \
+        size_t i = 0;                                                                      \
+        LANES_LOOP(i, length,                                                              \
+                   lanes_store(out + i, lanes_op(lanes_load(a + i), lanes_set(b))));       \
+        for (; i < length; i++) {                                                          \
+            out[i] = a[i] op b;                                                            \
+        }                                                                                  \
+    }                                                                                      \
+                                                                                           \
+    static void name##_reversed(double* out, double* a, double b, size_t length) {         \
+        size_t i = 0;                                                                      \
+        LANES_LOOP(i, length,                                                              \
+                   lanes_store(out + i, lanes_op(lanes_set(b), lanes_load(a + i))));       \
+        for (; i < length; i++) {                                                          \
+            out[i] = b op a[i];                                                            \
+        }                                                                                  \
+    }
+
+ELEMENTWISE_KERNELS(add, lanes_add, +)
+ELEMENTWISE_KERNELS(subtract, lanes_subtract, -)
+ELEMENTWISE_KERNELS(multiply, lanes_multiply, *)
+ELEMENTWISE_KERNELS(divide, lanes_divide, /)
+
+void array_apply(array_op op, double* out, double* a, double* b, size_t length) {
+    switch (op) {
+        case ARRAY_ADD:
+            add(out, a, b, length);
+            break;
+        case ARRAY_SUBTRACT:
+            subtract(out, a, b, length);
+            break;
+        case ARRAY_MULTIPLY:
+            multiply(out, a, b, length);
+            break;
+        case ARRAY_DIVIDE:
+            divide(out, a, b, length);
+            break;
+    }
+}
+
+// reversed, the scalar is the left operand (e.g., b - a[i])
+void array_apply_scalar(array_op op, double* out, double* a, double b, size_t length, int reversed) {
+    switch (op) {
+        case ARRAY_ADD:
+            (reversed ? add_reversed : add_scalar)(out, a, b, length);
+            break;
+        case ARRAY_SUBTRACT:
+            (reversed ? subtract_reversed : subtract_scalar)(out, a, b, length);
+            break;
+        case ARRAY_MULTIPLY:
+            (reversed ? multiply_reversed : multiply_scalar)(out, a, b, length);
+            break;
+        case ARRAY_DIVIDE:
+            (reversed ? divide_reversed : divide_scalar)(out, a, b, length);
+            break;
+    }
+}
+
+// the reductions keep a partial result per lane, so the sums
+// may differ from the ones added up in order in the last bits
+#ifdef ARRAY_LANES
+static double sum_lanes(lanes l) {
+    double partial[ARRAY_LANES];
+    lanes_store(partial, l);
+
+    double result = 0;
+    for (size_t i = 0; i < ARRAY_LANES; i++) {
+        result += partial[i];
+    }
+
+    return result;
+}
+#endif
+
+double array_sum(double* a, size_t length) {
+    double result = 0;
+    size_t i = 0;
+#ifdef ARRAY_LANES
+    lanes partial = lanes_set(0);
+    LANES_LOOP(i, length, partial = lanes_add(partial, lanes_load(a + i)));
+    result = sum_lanes(partial);
+#endif
+    for (; i < length; i++) {
+        result += a[i];
+    }
+
+    return result;
+}
+
+double array_dot(double* a, double* b, size_t length) {
+    double result = 0;
+    size_t i = 0;
+#ifdef ARRAY_LANES
+    lanes partial = lanes_set(0);
+    LANES_LOOP(i, length,
+               partial = lanes_add(partial, lanes_multiply(lanes_load(a + i), lanes_load(b + i))));
+    result = sum_lanes(partial);
+#endif
+    for (; i < length; i++) {
+        result += a[i] * b[i];
+    }
+
+    return result;
+}
+
+// the extrema are only defined for non-empty arrays
+#define EXTREMUM_KERNEL(name, lanes_op, better)                  \
+    double name(double* a, size_t length) {                     \
+        double result = a[0];                                   \
+        size_t i = 0;                                           \
+        EXTREMUM_LANES(lanes_op, better);                       \
+        for (; i < length; i++) {                               \
+            if (a[i] better result) {                           \
+                result = a[i];                                  \
+            }                                                   \
+        }                                                       \
+                                                                \
+        return result;                                          \
+    }
+
+#ifdef ARRAY_LANES
+#define EXTREMUM_LANES(lanes_op, better)                        \
+    if (length >= ARRAY_LANES) {                                \
+        lanes partial = lanes_load(a);                          \
+        LANES_LOOP(i, length,                                   \
+                   partial = lanes_op(partial, lanes_load(a + i))); \
+        double extrema[ARRAY_LANES];                            \
+        lanes_store(extrema, partial);                          \
+        for (size_t j = 0; j < ARRAY_LANES; j++) {              \
+            if (j == 0 || extrema[j] better result) {           \
+                result = extrema[j];                            \
+            }                                                   \
+        }                                                       \
+    }
+#else
+#define EXTREMUM_LANES(lanes_op, better)
+#endif
+
+EXTREMUM_KERNEL(array_min, lanes_min, <)
+EXTREMUM_KERNEL(array_max, lanes_max, >)
@@ -0,0 +1,29 @@
+#ifndef ARRAY_H_
+#define ARRAY_H_
+
+#include <stdio.h>
+
+#include "value.h"
+
+typedef enum {
+    ARRAY_ADD,
+    ARRAY_SUBTRACT,
+    ARRAY_MULTIPLY,
+    ARRAY_DIVIDE
+} array_op;
+
+value* array_new(size_t length);
+value* array_slice(value_array* a, size_t start, size_t end);
+void array_release(value_array* a);
+
+int array_to_str(value_array* a, char* buffer);
+void array_print(value_array* a, FILE* stream);
+
+void array_apply(array_op op, double* out, double* a, double* b, size_t length);
+void array_apply_scalar(array_op op, double* out, double* a, double b, size_t length, int reversed);
+double array_sum(double* a, size_t length);
+double array_dot(double* a, double* b, size_t length);
+double array_min(double* a, size_t length);
+double array_max(double* a, size_t length);
+
+#endif  // ARRAY_H_
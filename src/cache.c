@@ -0,0 +1,218 @@
+#include "cache.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "serialize.h"
+#include "value.h"
+
+#define CACHE_MAGIC "mylispc"
+#define CACHE_VERSION 2
+#define CACHE_SUFFIX ".cache"
+
+// the cache file starts with this header, followed by the
+// source key (its absolute path) and the serialized forms
+typedef struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_length;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t num_forms;
+} cache_header;
+
+static char* get_cache_path(char* source_path) {
+    char* path = malloc(strlen(source_path) + strlen(CACHE_SUFFIX) + 1);
+    strcpy(path, source_path);
+    strcat(path, CACHE_SUFFIX);
+
+    return path;
+}
+
+static int init_header(cache_header* h, char* source_path, char* key) {
+    struct stat st;
+    if (stat(source_path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    memset(h, 0, sizeof(cache_header));
+    memcpy(h->magic, CACHE_MAGIC, sizeof(h->magic));
+    h->version = CACHE_VERSION;
+    h->key_length = strlen(key);
+    h->mtime_sec = st.st_mtim.tv_sec;
+    h->mtime_nsec = st.st_mtim.tv_nsec;
+    h->size = st.st_size;
+
+    return 1;
+}
+
+static char* get_key(char* source_path, char* buffer) {
+    return (realpath(source_path, buffer) != NULL) ? buffer : source_path;
+}
+
+int cache_open(cache* c, char* source_path) {
+    memset(c, 0, sizeof(cache));
+
+    char buffer[PATH_MAX];
+    char* key = get_key(source_path, buffer);
+
+    cache_header expected;
+    if (!init_header(&expected, source_path, key)) {
+        return 0;
+    }
+
+    char* path = get_cache_path(source_path);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cache_header) + expected.key_length) {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    cache_header actual;
+    memcpy(&actual, data, sizeof(cache_header));
+    expected.num_forms = actual.num_forms;
+
+    // the cache is stale if the source has been touched (or moved) since
+    if (memcmp(&actual, &expected, sizeof(cache_header)) != 0 ||
+        memcmp((char*)data + sizeof(cache_header), key, expected.key_length) != 0) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+
+    c->data = data;
+    c->length = st.st_size;
+    c->running = c->data + sizeof(cache_header) + expected.key_length;
+    c->num_forms = actual.num_forms;
+
+    return 1;
+}
+
+value* cache_next(cache* c) {
+    if (c->num_read == c->num_forms) {
+        return NULL;
+    }
+
+    value* form = value_deserialize(&c->running, c->data + c->length);
+    if (form == NULL) {
+        c->num_read = c->num_forms;
+        return value_new_error("malformed cache entry #%zu", c->num_read);
+    }
+    c->num_read++;
+
+    return form;
+}
+
+void cache_close(cache* c) {
+    if (c->data != NULL) {
+        munmap(c->data, c->length);
+        c->data = NULL;
+    }
+}
+
+int cache_create(cache* c, char* source_path) {
+    memset(c, 0, sizeof(cache));
+
+    char buffer[PATH_MAX];
+    char* key = get_key(source_path, buffer);
+
+    cache_header header;
+    if (!init_header(&header, source_path, key)) {
+        return 0;
+    }
+
+    c->path = get_cache_path(source_path);
+    c->temp_path = malloc(strlen(c->path) + 8);
+    sprintf(c->temp_path, "%s.XXXXXX", c->path);
+
+    // the cache is written aside and renamed when
+    // complete, so readers never see a partial file
+    int fd = mkstemp(c->temp_path);
+    if (fd == -1) {
+        free(c->temp_path);
+        c->temp_path = NULL;
+        cache_abort(c);
+        return 0;
+    }
+
+    fchmod(fd, 0644);
+    c->file = fdopen(fd, "wb");
+    if (c->file == NULL ||
+        fwrite(&header, sizeof(header), 1, c->file) != 1 ||
+        fwrite(key, 1, header.key_length, c->file) != header.key_length) {
+        cache_abort(c);
+        return 0;
+    }
+
+    return 1;
+}
+
+void cache_add(cache* c, value* form) {
+    if (c->file != NULL) {
+        if (value_serialize(form, c->file)) {
+            c->num_forms++;
+        } else {
+            cache_abort(c);
+        }
+    }
+}
+
+void cache_commit(cache* c) {
+    if (c->file != NULL) {
+        uint64_t num_forms = c->num_forms;
+        long position = offsetof(cache_header, num_forms);
+        if (fseek(c->file, position, SEEK_SET) != 0 ||
+            fwrite(&num_forms, sizeof(num_forms), 1, c->file) != 1 ||
+            fclose(c->file) != 0) {
+            c->file = NULL;
+            cache_abort(c);
+            return;
+        }
+        c->file = NULL;
+
+        if (rename(c->temp_path, c->path) != 0) {
+            remove(c->temp_path);
+        }
+    }
+
+    free(c->path);
+    free(c->temp_path);
+    c->path = NULL;
+    c->temp_path = NULL;
+}
+
+void cache_abort(cache* c) {
+    if (c->file != NULL) {
+        fclose(c->file);
+        c->file = NULL;
+    }
+
+    if (c->temp_path != NULL) {
+        remove(c->temp_path);
+    }
+
+    free(c->path);
+    free(c->temp_path);
+    c->path = NULL;
+    c->temp_path = NULL;
+}
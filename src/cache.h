@@ -0,0 +1,28 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdio.h>
+
+#include "value.h"
+
+typedef struct cache {
+    char* path;
+    char* temp_path;
+    FILE* file;
+    char* data;
+    char* running;
+    size_t length;
+    size_t num_forms;
+    size_t num_read;
+} cache;
+
+int cache_open(cache* c, char* source_path);
+value* cache_next(cache* c);
+void cache_close(cache* c);
+
+int cache_create(cache* c, char* source_path);
+void cache_add(cache* c, value* form);
+void cache_commit(cache* c);
+void cache_abort(cache* c);
+
+#endif  // CACHE_H_
@@ -0,0 +1,356 @@
+#include "channel.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "value.h"
+
+#define CHANNEL_CACHE_LINE 64
+
+// a bounded multi-producer multi-consumer queue (after Dmitry Vyukov):
+// the producers and consumers claim cells by advancing their positions
+// with a compare-and-swap, and each cell's sequence number tells whether
+// it is ready to be written (== position) or read (== position + 1)
+typedef struct channel_cell {
+    size_t sequence;
+    value* data;
+} channel_cell;
+
+// a select parks on a waiter of its own, which it registers with
+// all of its channels, and which they signal on sending or closing
+typedef struct channel_waiter {
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    int signaled;
+} channel_waiter;
+
+// the threads only park on the mutex and condition variables
+// when the queue is full (sending) or empty (receiving)
+struct value_channel {
+    channel_cell* cells;
+    size_t mask;
+    char pad0[CHANNEL_CACHE_LINE];
+    size_t enqueue_position;
+    char pad1[CHANNEL_CACHE_LINE];
+    size_t dequeue_position;
+    char pad2[CHANNEL_CACHE_LINE];
+    int closed;
+    size_t num_waiting_senders;
+    size_t num_waiting_receivers;
+    channel_waiter** selectors;
+    size_t num_selectors;
+    size_t selectors_capacity;
+    size_t num_refs;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+};
+
+static int try_enqueue(value_channel* c, value* v) {
+    size_t position = __atomic_load_n(&c->enqueue_position, __ATOMIC_RELAXED);
+    channel_cell* cell;
+
+    while (1) {
+        cell = &c->cells[position & c->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&c->enqueue_position, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // full
+            return 0;
+        } else {
+            position = __atomic_load_n(&c->enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = v;
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static int try_dequeue(value_channel* c, value** v) {
+    size_t position = __atomic_load_n(&c->dequeue_position, __ATOMIC_RELAXED);
+    channel_cell* cell;
+
+    while (1) {
+        cell = &c->cells[position & c->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&c->dequeue_position, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // empty
+            return 0;
+        } else {
+            position = __atomic_load_n(&c->dequeue_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    *v = cell->data;
+    __atomic_store_n(&cell->sequence, position + c->mask + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+// the waiting side counts itself before retrying under the mutex and
+// the other side reads the count after its operation, so at least
+// one of them sees the other (the fences order the two)
+static void wake(value_channel* c, size_t* num_waiting, pthread_cond_t* cond) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(num_waiting, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&c->mutex);
+        pthread_cond_broadcast(cond);
+        pthread_mutex_unlock(&c->mutex);
+    }
+}
+
+static void signal_waiter(channel_waiter* w) {
+    pthread_mutex_lock(&w->mutex);
+    w->signaled = 1;
+    pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+// the selects are woken like the receivers: they register
+// before polling, and the count is read after the operation
+static void wake_selectors(value_channel* c) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&c->num_selectors, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&c->mutex);
+        for (size_t i = 0; i < c->num_selectors; i++) {
+            signal_waiter(c->selectors[i]);
+        }
+        pthread_mutex_unlock(&c->mutex);
+    }
+}
+
+static void add_selector(value_channel* c, channel_waiter* w) {
+    pthread_mutex_lock(&c->mutex);
+    if (c->num_selectors == c->selectors_capacity) {
+        c->selectors_capacity = (c->selectors_capacity > 0) ? 2 * c->selectors_capacity : 4;
+        c->selectors = realloc(c->selectors, c->selectors_capacity * sizeof(channel_waiter*));
+    }
+    c->selectors[c->num_selectors] = w;
+    __atomic_add_fetch(&c->num_selectors, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&c->mutex);
+}
+
+static void remove_selector(value_channel* c, channel_waiter* w) {
+    pthread_mutex_lock(&c->mutex);
+    for (size_t i = 0; i < c->num_selectors; i++) {
+        if (c->selectors[i] == w) {
+            c->selectors[i] = c->selectors[c->num_selectors - 1];
+            __atomic_sub_fetch(&c->num_selectors, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&c->mutex);
+}
+
+value* channel_new(size_t capacity) {
+    // the capacity is rounded up to a power of two (at least
+    // two), for the positions to map to the cells with a mask:
+    // bounded, so that neither the doubling nor the size overflow
+    if (capacity > SIZE_MAX / 2 / sizeof(channel_cell)) {
+        return NULL;
+    }
+    size_t num_cells = 2;
+    while (num_cells < capacity) {
+        num_cells *= 2;
+    }
+
+    value_channel* c = malloc(sizeof(value_channel));
+    c->cells = malloc(num_cells * sizeof(channel_cell));
+    if (c->cells == NULL) {
+        free(c);
+        return NULL;
+    }
+    for (size_t i = 0; i < num_cells; i++) {
+        c->cells[i].sequence = i;
+        c->cells[i].data = NULL;
+    }
+    c->mask = num_cells - 1;
+    c->enqueue_position = 0;
+    c->dequeue_position = 0;
+    c->closed = 0;
+    c->num_waiting_senders = 0;
+    c->num_waiting_receivers = 0;
+    c->selectors = NULL;
+    c->num_selectors = 0;
+    c->selectors_capacity = 0;
+    c->num_refs = 1;
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->not_full, NULL);
+    pthread_cond_init(&c->not_empty, NULL);
+
+    return value_new_channel(c);
+}
+
+int channel_send(value_channel* c, value* v) {
+    if (channel_is_closed(c)) {
+        return 0;
+    }
+
+    if (!try_enqueue(c, v)) {
+        int sent = 0;
+
+        pthread_mutex_lock(&c->mutex);
+        __atomic_add_fetch(&c->num_waiting_senders, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (!c->closed) {
+            if (try_enqueue(c, v)) {
+                sent = 1;
+                break;
+            }
+            pthread_cond_wait(&c->not_full, &c->mutex);
+        }
+        __atomic_sub_fetch(&c->num_waiting_senders, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&c->mutex);
+
+        if (!sent) {
+            return 0;
+        }
+    }
+
+    wake(c, &c->num_waiting_receivers, &c->not_empty);
+    wake_selectors(c);
+
+    return 1;
+}
+
+int channel_try_receive(value_channel* c, value** v) {
+    if (!try_dequeue(c, v)) {
+        return 0;
+    }
+
+    wake(c, &c->num_waiting_senders, &c->not_full);
+
+    return 1;
+}
+
+value* channel_receive(value_channel* c) {
+    value* v = NULL;
+    if (channel_try_receive(c, &v)) {
+        return v;
+    }
+
+    pthread_mutex_lock(&c->mutex);
+    __atomic_add_fetch(&c->num_waiting_receivers, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (1) {
+        if (try_dequeue(c, &v)) {
+            break;
+        }
+        if (c->closed) {
+            // closed and drained
+            v = NULL;
+            break;
+        }
+        pthread_cond_wait(&c->not_empty, &c->mutex);
+    }
+    __atomic_sub_fetch(&c->num_waiting_receivers, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&c->mutex);
+
+    if (v != NULL) {
+        wake(c, &c->num_waiting_senders, &c->not_full);
+    }
+
+    return v;
+}
+
+int channel_close(value_channel* c) {
+    pthread_mutex_lock(&c->mutex);
+    int was_open = !c->closed;
+    __atomic_store_n(&c->closed, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&c->not_full);
+    pthread_cond_broadcast(&c->not_empty);
+    for (size_t i = 0; i < c->num_selectors; i++) {
+        signal_waiter(c->selectors[i]);
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    return was_open;
+}
+
+// the channels are polled in turn, and between the rounds the
+// caller parks until any of them is sent a value or closed
+int channel_select(value_channel** channels, size_t num_channels, size_t* index, value** v) {
+    channel_waiter w;
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.ready, NULL);
+    w.signaled = 0;
+    for (size_t i = 0; i < num_channels; i++) {
+        add_selector(channels[i], &w);
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    int received = 0;
+    while (1) {
+        // reset before polling, for a signal sent while
+        // polling to keep the waiter from parking after it
+        pthread_mutex_lock(&w.mutex);
+        w.signaled = 0;
+        pthread_mutex_unlock(&w.mutex);
+
+        size_t num_closed = 0;
+        for (size_t i = 0; i < num_channels && !received; i++) {
+            // the closed state is read before polling, for
+            // a value sent before closing not to be missed
+            int closed = channel_is_closed(channels[i]);
+            if (channel_try_receive(channels[i], v)) {
+                *index = i;
+                received = 1;
+            }
+            num_closed += closed;
+        }
+        if (received || num_closed == num_channels) {
+            break;
+        }
+
+        pthread_mutex_lock(&w.mutex);
+        while (!w.signaled) {
+            pthread_cond_wait(&w.ready, &w.mutex);
+        }
+        pthread_mutex_unlock(&w.mutex);
+    }
+
+    for (size_t i = 0; i < num_channels; i++) {
+        remove_selector(channels[i], &w);
+    }
+    pthread_mutex_destroy(&w.mutex);
+    pthread_cond_destroy(&w.ready);
+
+    return received;
+}
+
+int channel_is_closed(value_channel* c) {
+    return __atomic_load_n(&c->closed, __ATOMIC_SEQ_CST);
+}
+
+void channel_retain(value_channel* c) {
+    __sync_fetch_and_add(&c->num_refs, 1);
+}
+
+void channel_release(value_channel* c) {
+    if (__sync_sub_and_fetch(&c->num_refs, 1) == 0) {
+        value* v;
+        while (try_dequeue(c, &v)) {
+            value_dispose(v);
+        }
+        free(c->cells);
+        free(c->selectors);
+        pthread_mutex_destroy(&c->mutex);
+        pthread_cond_destroy(&c->not_full);
+        pthread_cond_destroy(&c->not_empty);
+        free(c);
+    }
+}
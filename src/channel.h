@@ -0,0 +1,17 @@
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include "value.h"
+
+value* channel_new(size_t capacity);
+int channel_send(value_channel* c, value* v);
+value* channel_receive(value_channel* c);
+int channel_try_receive(value_channel* c, value** v);
+int channel_close(value_channel* c);
+int channel_is_closed(value_channel* c);
+int channel_select(value_channel** channels, size_t num_channels, size_t* index, value** v);
+
+void channel_retain(value_channel* c);
+void channel_release(value_channel* c);
+
+#endif  // CHANNEL_H_
@@ -6,9 +6,9 @@
 
 #ifdef _WIN32
 
-static char buffer[2048];
-
 char* readline(char* prompt) {
+    char buffer[2048];
+
     fputs(prompt, stdout);
     fgets(buffer, 2048, stdin);
 
@@ -4,46 +4,126 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "eval.h"
 #include "value.h"
 
 void environment_init(environment* e) {
     e->length = 0;
     e->capacity = 4;
-    e->names = malloc(e->capacity * sizeof(char*));
-    e->values = malloc(e->capacity * sizeof(value*));
+    e->bindings = malloc(e->capacity * sizeof(binding*));
     e->parent = NULL;
+    e->context.output = stdout;
+    e->context.userdata = NULL;
+}
+
+static binding* binding_new(char* name, value* v) {
+    size_t size = strlen(name) + 1;
+    binding* b = malloc(sizeof(binding) + size);
+    b->value = v;
+    b->num_refs = 1;
+    memcpy(b->name, name, size);
+
+    return b;
+}
+
+static void binding_retain(binding* b) {
+    __sync_fetch_and_add(&b->num_refs, 1);
+}
+
+static void binding_release(binding* b) {
+    if (__sync_sub_and_fetch(&b->num_refs, 1) == 0) {
+        if (b->value != NULL) {
+            value_dispose(b->value);
+        }
+        free(b);
+    }
+}
+
+static int binding_is_shared(binding* b) {
+    return __sync_add_and_fetch(&b->num_refs, 0) > 1;
 }
 
 void environment_dispose(environment* e) {
     for (size_t i = 0; i < e->length; i++) {
-        free(e->names[i]);
-        value_dispose(e->values[i]);
+        binding_release(e->bindings[i]);
+    }
+
+    free(e->bindings);
+}
+
+context* environment_get_context(environment* e) {
+    while (e->parent != NULL) {
+        e = e->parent;
     }
 
-    free(e->names);
-    free(e->values);
+    return &e->context;
 }
 
 static void environment_double(environment* e) {
     e->capacity *= 2;
-    e->names = realloc(e->names, e->capacity * sizeof(char*));
-    e->values = realloc(e->values, e->capacity * sizeof(value*));
+    e->bindings = realloc(e->bindings, e->capacity * sizeof(binding*));
 }
 
-value* environment_get(environment* e, char* name) {
+static binding** find_binding(environment* e, char* name) {
     for (size_t i = 0; i < e->length; i++) {
-        if (strcmp(e->names[i], name) == 0) {
-            return value_copy(e->values[i]);
+        if (strcmp(e->bindings[i]->name, name) == 0) {
+            return &e->bindings[i];
+        }
+    }
+
+    return NULL;
+}
+
+// the value is taken over: a shared binding is replaced
+// with a new one, and the others are changed in place
+static void rebind(binding** slot, value* v) {
+    binding* b = *slot;
+    if (binding_is_shared(b)) {
+        *slot = binding_new(b->name, v);
+        binding_release(b);
+    } else {
+        if (b->value != NULL) {
+            value_dispose(b->value);
         }
+        b->value = v;
+    }
+}
+
+value* environment_get(environment* e, char* name) {
+    binding** slot = find_binding(e, name);
+    if (slot != NULL) {
+        if ((*slot)->value == NULL) {
+            // a deleted builtin
+            return value_new_error("undefined symbol: %s", name);
+        }
+        return value_copy((*slot)->value);
     }
 
     if (e->parent != NULL) {
         return environment_get(e->parent, name);
+    }
+
+    value_fn builtin = get_builtin(name);
+    if (builtin != NULL) {
+        return value_new_function_builtin(builtin, name);
     } else {
         return value_new_error("undefined symbol: %s", name);
     }
 }
 
+// the value bound to the name, without copying it (NULL if the
+// name isn't bound); it stays valid until the name is rebound
+value* environment_borrow(environment* e, char* name) {
+    for (; e != NULL; e = e->parent) {
+        binding** slot = find_binding(e, name);
+        if (slot != NULL) {
+            return (*slot)->value;
+        }
+    }
+
+    return NULL;
+}
+
 void environment_put(environment* e, char* name, value* v, int local) {
     if (local == 0) {
         while (e->parent != NULL) {
@@ -51,33 +131,96 @@ void environment_put(environment* e, char* name, value* v, int local) {
         }
     }
 
-    for (size_t i = 0; i < e->length; i++) {
-        if (strcmp(e->names[i], name) == 0) {
-            value_dispose(e->values[i]);
-            e->values[i] = value_copy(v);
-            return;
-        }
+    binding** slot = find_binding(e, name);
+    if (slot != NULL) {
+        rebind(slot, value_copy(v));
+    } else {
+        environment_append(e, name, value_copy(v));
     }
+}
 
+void environment_append(environment* e, char* name, value* v) {
+    // the name must not be bound in e yet: the
+    // value is taken over without the lookup or a copy
     if (e->length == e->capacity) {
         environment_double(e);
     }
 
-    e->names[e->length] = malloc(strlen(name) + 1);
-    strcpy(e->names[e->length], name);
-    e->values[e->length] = value_copy(v);
-    e->length++;
+    e->bindings[e->length++] = binding_new(name, v);
+}
+
+static void share_binding(environment* e, binding* b) {
+    binding_retain(b);
+
+    binding** slot = find_binding(e, b->name);
+    if (slot != NULL) {
+        binding_release(*slot);
+        *slot = b;
+    } else {
+        if (e->length == e->capacity) {
+            environment_double(e);
+        }
+        e->bindings[e->length++] = b;
+    }
+}
+
+// the snapshot is a single frame with the bindings of all the
+// frames (the inner ones shadowing the outer ones), shared with
+// them: it costs a pointer per binding, however large the bound
+// values are, and neither side sees the other's later rebindings
+void environment_snapshot(environment* snapshot, environment* e) {
+    size_t num_frames = 0;
+    for (environment* frame = e; frame != NULL; frame = frame->parent) {
+        num_frames++;
+    }
+
+    // frames[0] is the global environment
+    environment** frames = malloc(num_frames * sizeof(environment*));
+    size_t f = num_frames;
+    for (environment* frame = e; frame != NULL; frame = frame->parent) {
+        frames[--f] = frame;
+    }
+
+    environment_init(snapshot);
+    snapshot->context = frames[0]->context;
+
+    // the global bindings (including the deleted builtins) are
+    // shared as they are, then shadowed by those of the inner frames
+    while (snapshot->capacity < frames[0]->length) {
+        environment_double(snapshot);
+    }
+    for (size_t i = 0; i < frames[0]->length; i++) {
+        binding_retain(frames[0]->bindings[i]);
+        snapshot->bindings[i] = frames[0]->bindings[i];
+    }
+    snapshot->length = frames[0]->length;
+
+    for (f = 1; f < num_frames; f++) {
+        for (size_t i = 0; i < frames[f]->length; i++) {
+            share_binding(snapshot, frames[f]->bindings[i]);
+        }
+    }
+
+    free(frames);
 }
 
 int environment_delete(environment* e, char* name) {
     for (size_t i = 0; i < e->length; i++) {
-        if (strcmp(e->names[i], name) == 0) {
-            free(e->names[i]);
-            value_dispose(e->values[i]);
+        if (strcmp(e->bindings[i]->name, name) == 0) {
+            if (e->bindings[i]->value == NULL) {
+                return 0;
+            }
+
+            if (e->parent == NULL && get_builtin(name) != NULL) {
+                // the builtin behind the binding must stay hidden
+                rebind(&e->bindings[i], NULL);
+                return 1;
+            }
+
+            binding_release(e->bindings[i]);
 
             for (size_t j = i; j < e->length - 1; j++) {
-                e->names[j] = e->names[j + 1];
-                e->values[j] = e->values[j + 1];
+                e->bindings[j] = e->bindings[j + 1];
             }
             e->length--;
 
@@ -87,6 +230,10 @@ int environment_delete(environment* e, char* name) {
 
     if (e->parent != NULL) {
         return environment_delete(e->parent, name);
+    } else if (get_builtin(name) != NULL) {
+        // a builtin is hidden by a binding without a value
+        environment_append(e, name, NULL);
+        return 1;
     } else {
         return 0;
     }
@@ -107,10 +254,26 @@ void environment_register_function(environment* e, char* name, value_fn function
 int environment_to_str(environment* e, char* buffer) {
     char* running = buffer;
     for (size_t i = 0; i < e->length; i++) {
+        if (e->bindings[i]->value == NULL) {
+            continue;
+        }
+
         char val_buffer[1024];
-        value_to_str(e->values[i], val_buffer);
-        running += sprintf(running, "%-10s:   %s\n", e->names[i], val_buffer);
+        value_to_str(e->bindings[i]->value, val_buffer);
+        running += sprintf(running, "%-10s:   %s\n", e->bindings[i]->name, val_buffer);
+    }
+
+    // the builtins aren't bound, so the global frame lists
+    // those not shadowed or deleted (tombstoned) after its own
+    if (e->parent == NULL) {
+        char* name;
+        for (size_t i = 0; (name = get_builtin_name_at(i)) != NULL; i++) {
+            if (find_binding(e, name) == NULL) {
+                running += sprintf(running, "%-10s:   <builtin %s>\n", name, name);
+            }
+        }
     }
+
     *running = '\0';
 
     return running - buffer;
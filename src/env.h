@@ -1,21 +1,47 @@
 #ifndef ENV_H_
 #define ENV_H_
 
+#include <stdio.h>
+
 #include "value.h"
 
+// the state of an interpreter, which is kept
+// in its global environment and reached from
+// any of its frames: no interpreter state is
+// process-wide, so interpreters can run
+// concurrently on different threads
+typedef struct context {
+    FILE* output;
+    void* userdata;
+} context;
+
+// the bindings are shared by a frame and its snapshots, and
+// while one is shared, rebinding its name replaces it instead
+// of changing it, so the snapshots don't copy the bound values
+typedef struct binding {
+    value* value;  // NULL for a deleted builtin
+    size_t num_refs;
+    char name[];
+} binding;
+
 struct environment {
-    char** names;
-    value** values;
+    binding** bindings;
     size_t length;
     size_t capacity;
     environment* parent;
+    context context;
 };
 
 void environment_init(environment* e);
 void environment_dispose(environment* e);
 
+context* environment_get_context(environment* e);
+
 value* environment_get(environment* e, char* name);
+value* environment_borrow(environment* e, char* name);
 void environment_put(environment* e, char* name, value* v, int local);
+void environment_append(environment* e, char* name, value* v);
+void environment_snapshot(environment* snapshot, environment* e);
 int environment_delete(environment* e, char* name);
 
 void environment_register_number(environment* e, char* name, double number);
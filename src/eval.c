@@ -2,14 +2,29 @@
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "array.h"
+#include "cache.h"
+#include "channel.h"
 #include "env.h"
+#include "future.h"
+#include "image.h"
+#include "map.h"
 #include "parse.h"
+#include "pool.h"
+#include "sort.h"
 #include "value.h"
 
+// integers are numbers too, for the functions taking any number
+static int is_of_type(value* v, value_type type) {
+    return v->type == type || (type == VALUE_NUMBER && v->type == VALUE_INTEGER);
+}
+
 #define ASSERT_NUM_ARGS(fn, num_args, expected_num_args) \
     {                                                    \
         if (num_args != expected_num_args) {             \
@@ -34,9 +49,21 @@
         }                                               \
     }
 
+#define ASSERT_MAX_NUM_ARGS(fn, num_args, max_num_args) \
+    {                                                   \
+        if (num_args > max_num_args) {                  \
+            return value_new_error(                     \
+                "%s expects at most %d arg%s, "         \
+                "but got %d",                           \
+                fn, max_num_args,                       \
+                (max_num_args == 1 ? "" : "s"),         \
+                num_args);                              \
+        }                                               \
+    }
+
 #define ASSERT_ARG_TYPE(fn, arg, expected_type, ordinal) \
     {                                                    \
-        if (arg->type != expected_type) {                \
+        if (!is_of_type(arg, expected_type)) {           \
             char buffer[1024];                           \
             value_to_str(arg, buffer);                   \
             return value_new_error(                      \
@@ -58,7 +85,7 @@
 #define ASSERT_EXPR_CHILDREN_TYPE(fn, arg, expected_type, ordinal) \
     {                                                              \
         for (size_t i = 0; i < arg->num_children; i++) {           \
-            if (arg->children[i]->type != expected_type) {         \
+            if (!is_of_type(arg->children[i], expected_type)) {    \
                 char buffer[1024];                                 \
                 value_to_str(arg, buffer);                         \
                 return value_new_error(                            \
@@ -97,16 +124,137 @@
         }                                                   \
     }
 
-static value* builtin_add(value** args, size_t num_args, char* name, environment* env) {
-    ASSERT_MIN_NUM_ARGS(name, num_args, 1);
-    ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
+#define ASSERT_FILE_OPEN(fn, arg, ordinal)           \
+    {                                                \
+        if (arg->file->stream == NULL) {             \
+            return value_new_error(                  \
+                "%s: arg #%d (<file %s>) is closed", \
+                fn, ordinal, arg->file->path);       \
+        }                                            \
+    }
 
-    double result = (*args++)->number;
+#define ASSERT_HASHABLE(fn, arg, ordinal)           \
+    {                                               \
+        if (!map_is_hashable(arg)) {                \
+            char buffer[1024];                      \
+            value_to_str(arg, buffer);              \
+            return value_new_error(                 \
+                "%s: arg #%d (%s) "                 \
+                "must be hashable, but got %s",     \
+                fn, ordinal, buffer,                \
+                get_value_type_name(arg->type));    \
+        }                                           \
+    }
+
+// an integer operation fails when its result is not an integer
+// (e.g., on an overflow), and the fold goes on with doubles from
+// that operand on, so mixing in a double promotes the result too
+typedef int (*integer_op)(int64_t a, int64_t b, int64_t* result);
+typedef double (*double_op)(double a, double b);
+
+static value* fold_numbers(value** args, size_t num_args, integer_op iop, double_op dop) {
+    size_t i = 1;
+    int64_t integer = args[0]->integer;
+    double number = args[0]->number;
+
+    if (args[0]->type == VALUE_INTEGER) {
+        for (; i < num_args && args[i]->type == VALUE_INTEGER; i++) {
+            int64_t next;
+            if (!iop(integer, args[i]->integer, &next)) {
+                break;
+            }
+            integer = next;
+        }
+        if (i == num_args) {
+            return value_new_integer(integer);
+        }
+        number = integer;
+    }
+
+    for (; i < num_args; i++) {
+        number = dop(number, args[i]->number);
+    }
+
+    return value_new_number(number);
+}
+
+static int add_integers(int64_t a, int64_t b, int64_t* result) {
+    return !__builtin_add_overflow(a, b, result);
+}
+
+static double add_doubles(double a, double b) {
+    return a + b;
+}
+
+static int subtract_integers(int64_t a, int64_t b, int64_t* result) {
+    return !__builtin_sub_overflow(a, b, result);
+}
+
+static double subtract_doubles(double a, double b) {
+    return a - b;
+}
+
+static int multiply_integers(int64_t a, int64_t b, int64_t* result) {
+    return !__builtin_mul_overflow(a, b, result);
+}
+
+static double multiply_doubles(double a, double b) {
+    return a * b;
+}
+
+static int divide_integers(int64_t a, int64_t b, int64_t* result) {
+    // only exact quotients stay integers
+    if (b == -1 && a == INT64_MIN) {
+        return 0;
+    } else if (a % b != 0) {
+        return 0;
+    }
+    *result = a / b;
+    return 1;
+}
+
+static double divide_doubles(double a, double b) {
+    return a / b;
+}
+
+static int modulo_integers(int64_t a, int64_t b, int64_t* result) {
+    *result = (b == -1) ? 0 : a % b;
+    return 1;
+}
+
+static int minimum_integers(int64_t a, int64_t b, int64_t* result) {
+    *result = (b < a) ? b : a;
+    return 1;
+}
+
+static double minimum_doubles(double a, double b) {
+    return (b < a) ? b : a;
+}
+
+static int maximum_integers(int64_t a, int64_t b, int64_t* result) {
+    *result = (b > a) ? b : a;
+    return 1;
+}
+
+static double maximum_doubles(double a, double b) {
+    return (b > a) ? b : a;
+}
+
+static value* check_divisors(value** args, size_t num_args) {
     for (size_t i = 1; i < num_args; i++) {
-        result += (*args++)->number;
+        if (args[i]->number == 0) {
+            return value_new_error("division by zero");
+        }
     }
 
-    return value_new_number(result);
+    return NULL;
+}
+
+static value* builtin_add(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
+
+    return fold_numbers(args, num_args, add_integers, add_doubles);
 }
 
 static value* builtin_subtract(value** args, size_t num_args, char* name, environment* env) {
@@ -114,54 +262,44 @@ static value* builtin_subtract(value** args, size_t num_args, char* name, enviro
     ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
 
     if (num_args == 1) {
-        return value_new_number(-(*args)->number);
-    }
-
-    double result = (*args++)->number;
-    for (size_t i = 1; i < num_args; i++) {
-        result -= (*args++)->number;
+        if (args[0]->type == VALUE_INTEGER && args[0]->integer != INT64_MIN) {
+            return value_new_integer(-args[0]->integer);
+        }
+        return value_new_number(-args[0]->number);
     }
 
-    return value_new_number(result);
+    return fold_numbers(args, num_args, subtract_integers, subtract_doubles);
 }
 
 static value* builtin_multiply(value** args, size_t num_args, char* name, environment* env) {
     ASSERT_MIN_NUM_ARGS(name, num_args, 1);
     ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
 
-    double result = (*args++)->number;
-    for (size_t i = 1; i < num_args; i++) {
-        result *= (*args++)->number;
-    }
-
-    return value_new_number(result);
+    return fold_numbers(args, num_args, multiply_integers, multiply_doubles);
 }
 
 static value* builtin_divide(value** args, size_t num_args, char* name, environment* env) {
     ASSERT_MIN_NUM_ARGS(name, num_args, 1);
     ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
 
-    double result = (*args++)->number;
-    for (size_t i = 1; i < num_args; i++) {
-        if ((*args)->number == 0) {
-            return value_new_error("division by zero");
-        }
-        result /= (*args++)->number;
+    value* error = check_divisors(args, num_args);
+    if (error != NULL) {
+        return error;
     }
 
-    return value_new_number(result);
+    return fold_numbers(args, num_args, divide_integers, divide_doubles);
 }
 
 static value* builtin_modulo(value** args, size_t num_args, char* name, environment* env) {
     ASSERT_MIN_NUM_ARGS(name, num_args, 1);
     ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
 
-    int result = (int)(*args++)->number;
-    for (size_t i = 1; i < num_args; i++) {
-        result %= (int)(*args++)->number;
+    value* error = check_divisors(args, num_args);
+    if (error != NULL) {
+        return error;
     }
 
-    return value_new_number(result);
+    return fold_numbers(args, num_args, modulo_integers, fmod);
 }
 
 static value* builtin_power(value** args, size_t num_args, char* name, environment* env) {
@@ -180,30 +318,14 @@ static value* builtin_minimum(value** args, size_t num_args, char* name, environ
     ASSERT_MIN_NUM_ARGS(name, num_args, 1);
     ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
 
-    double result = (*args++)->number;
-    for (size_t i = 1; i < num_args; i++) {
-        double other = (*args++)->number;
-        if (other < result) {
-            result = other;
-        }
-    }
-
-    return value_new_number(result);
+    return fold_numbers(args, num_args, minimum_integers, minimum_doubles);
 }
 
 static value* builtin_maximum(value** args, size_t num_args, char* name, environment* env) {
     ASSERT_MIN_NUM_ARGS(name, num_args, 1);
     ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
 
-    double result = (*args++)->number;
-    for (size_t i = 1; i < num_args; i++) {
-        double other = (*args++)->number;
-        if (other > result) {
-            result = other;
-        }
-    }
-
-    return value_new_number(result);
+    return fold_numbers(args, num_args, maximum_integers, maximum_doubles);
 }
 
 static value* builtin_list(value** args, size_t num_args, char* name, environment* env) {
@@ -290,9 +412,14 @@ static value* builtin_cons(value** args, size_t num_args, char* name, environmen
 
 static value* builtin_len(value** args, size_t num_args, char* name, environment* env) {
     ASSERT_NUM_ARGS(name, num_args, 1);
+    if (args[0]->type == VALUE_ARRAY) {
+        return value_new_integer(args[0]->array->length);
+    } else if (args[0]->type == VALUE_MAP) {
+        return value_new_integer(map_length(args[0]->map));
+    }
     ASSERT_ARG_TYPE(name, args[0], VALUE_QEXPR, 0);
 
-    return value_new_number(args[0]->num_children);
+    return value_new_integer(args[0]->num_children);
 }
 
 static value* builtin_init(value** args, size_t num_args, char* name, environment* env) {
@@ -308,6 +435,110 @@ static value* builtin_init(value** args, size_t num_args, char* name, environmen
     return result;
 }
 
+// the indices are 0-based positions in a q-expr or an array
+#define ASSERT_INDEX(fn, arg, ordinal)                       \
+    {                                                        \
+        ASSERT_ARG_TYPE(fn, arg, VALUE_NUMBER, ordinal);     \
+        if (arg->number < 0 || arg->number != floor(arg->number)) { \
+            char buffer[1024];                               \
+            value_to_str(arg, buffer);                       \
+            return value_new_error(                          \
+                "%s: arg #%d (%s) "                          \
+                "must be a non-negative integer",            \
+                fn, ordinal, buffer);                        \
+        }                                                    \
+    }
+
+#define ASSERT_SEQUENCE(fn, arg, ordinal)                    \
+    {                                                        \
+        if (arg->type != VALUE_ARRAY) {                      \
+            ASSERT_ARG_TYPE(fn, arg, VALUE_QEXPR, ordinal);  \
+        }                                                    \
+    }
+
+static size_t get_sequence_length(value* v) {
+    return (v->type == VALUE_ARRAY) ? v->array->length : v->num_children;
+}
+
+// the items in [start, end) of a q-expr, or a view of an array's
+static value* get_subsequence(value* v, size_t start, size_t end) {
+    if (v->type == VALUE_ARRAY) {
+        return array_slice(v->array, start, end);
+    }
+
+    value* result = value_new_qexpr();
+    if (end - start > result->capacity) {
+        result->capacity = end - start;
+        result->children = realloc(result->children, result->capacity * sizeof(value*));
+    }
+    for (size_t i = start; i < end; i++) {
+        value_add_child(result, value_copy(v->children[i]));
+    }
+
+    return result;
+}
+
+static value* builtin_nth(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_SEQUENCE(name, args[0], 0);
+    ASSERT_INDEX(name, args[1], 1);
+
+    size_t length = get_sequence_length(args[0]);
+    if (args[1]->number >= length) {
+        return value_new_error("%s: index %g is out of the range of %zu items", name, args[1]->number, length);
+    }
+
+    size_t index = args[1]->number;
+    if (args[0]->type == VALUE_ARRAY) {
+        return value_new_number(args[0]->array->data[index]);
+    }
+
+    return value_copy(args[0]->children[index]);
+}
+
+static value* builtin_slice(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 2);
+    ASSERT_MAX_NUM_ARGS(name, num_args, 3);
+    ASSERT_SEQUENCE(name, args[0], 0);
+    for (size_t i = 1; i < num_args; i++) {
+        ASSERT_INDEX(name, args[i], i);
+    }
+
+    size_t length = get_sequence_length(args[0]);
+    double start = args[1]->number;
+    double end = (num_args > 2) ? args[2]->number : length;
+    if (start > end || end > length) {
+        return value_new_error(
+            "%s: slice [%g, %g) is out of the range of %zu items",
+            name, start, end, length);
+    }
+
+    return get_subsequence(args[0], start, end);
+}
+
+// unlike slice, take and drop allow counts beyond the length
+static value* builtin_take(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_SEQUENCE(name, args[0], 0);
+    ASSERT_INDEX(name, args[1], 1);
+
+    size_t length = get_sequence_length(args[0]);
+    size_t count = (args[1]->number < length) ? args[1]->number : length;
+
+    return get_subsequence(args[0], 0, count);
+}
+
+static value* builtin_drop(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_SEQUENCE(name, args[0], 0);
+    ASSERT_INDEX(name, args[1], 1);
+
+    size_t length = get_sequence_length(args[0]);
+    size_t count = (args[1]->number < length) ? args[1]->number : length;
+
+    return get_subsequence(args[0], count, length);
+}
+
 static value* builtin_var(value** args, size_t num_args, char* name, environment* env, int local) {
     ASSERT_MIN_NUM_ARGS(name, num_args, 2);
     ASSERT_ARG_TYPE(name, args[0], VALUE_QEXPR, 0);
@@ -454,16 +685,14 @@ static value* builtin_comp(value** args, size_t num_args, char* name, environmen
     ASSERT_MIN_NUM_ARGS(name, num_args, 2);
 
     int truth = 1;
-    int sub_direction;
-    value* sub_result;
 
     for (size_t i = 0; i < num_args - 1; i++) {
-        sub_result = value_compare(args[i], args[i + 1]);
-        if (sub_result->type == VALUE_ERROR) {
-            return sub_result;
+        // the values are compared without allocating a result
+        value* error = NULL;
+        int sub_direction = value_order(args[i], args[i + 1], &error) * direction;
+        if (error != NULL) {
+            return error;
         }
-        sub_direction = sub_result->number * direction;
-        value_dispose(sub_result);
 
         if ((!inverse && sub_direction <= 0) || (inverse && sub_direction > 0)) {
             truth = 0;
@@ -632,14 +861,15 @@ static value* builtin_seval(value** args, size_t num_args, char* name, environme
 
     if (v->type != VALUE_ERROR) {
         if (batch) {
-            char buffer[1024];
             size_t counter = 0;
             size_t num_children = v->num_children;
             for (size_t i = 0; i < num_children; i++) {
                 value* e = value_evaluate(v->children[i], env);
                 if (verbose) {
-                    value_to_str(e, buffer);
-                    printf("\x1B[32m%zu:\x1B[0m %s\n", ++counter, buffer);
+                    FILE* output = environment_get_context(env)->output;
+                    fprintf(output, "\x1B[32m%zu:\x1B[0m ", ++counter);
+                    value_print(e, output);
+                    fputc('\n', output);
                 }
                 value_dispose(e);
             }
@@ -657,55 +887,124 @@ static value* builtin_seval(value** args, size_t num_args, char* name, environme
     return v;
 }
 
-static value* builtin_load(value** args, size_t num_args, char* name, environment* env) {
-    ASSERT_NUM_ARGS(name, num_args, 1);
-    ASSERT_ARG_TYPE(name, args[0], VALUE_STRING, 0);
+static void evaluate_loaded(value* form, environment* env, size_t* counter) {
+    value* e = value_evaluate(form, env);
+    FILE* output = environment_get_context(env)->output;
+    fprintf(output, "\x1B[32m%zu:\x1B[0m ", ++(*counter));
+    value_print(e, output);
+    fputc('\n', output);
+    value_dispose(e);
+}
 
+static value* load_from_cache(cache* c, environment* env, size_t* counter) {
     value* result = NULL;
-    FILE* file = fopen(args[0]->symbol, "r");
-
-    if (file) {
-        fseek(file, 0, SEEK_END);
-        long length = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        char* content = malloc(length + 1);
-        fread(content, 1, length, file);
-        content[length] = '\0';
-
-        if (ferror(file)) {
-            result = value_new_error("error reading from file: %s", args[0]->symbol);
-        } else {
-            value* seval_args = value_new_sexpr();
-            value_add_child(seval_args, value_new_string(content));
-            value_add_child(seval_args, value_new_bool(1));  // batch
-            value_add_child(seval_args, value_new_bool(1));  // verbose
 
-            result = builtin_seval(seval_args->children, 3, name, env);
+    value* form = NULL;
+    while ((form = cache_next(c)) != NULL) {
+        if (form->type == VALUE_ERROR) {
+            result = form;
+            break;
+        }
+
+        evaluate_loaded(form, env, counter);
+        value_dispose(form);
+    }
+
+    return result;
+}
+
+static value* load_from_source(char* path, environment* env, size_t* counter) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return value_new_error("failed to open file: %s", path);
+    }
+
+    value* result = NULL;
+
+    reader r;
+    reader_init(&r, file);
 
-            value_dispose(seval_args);
+    // the parsed forms are cached along the way,
+    // so that the next load can skip the parsing
+    cache c;
+    cache_create(&c, path);
+
+    // forms are parsed and evaluated one at a time, so
+    // only the current form is kept in memory at once
+    value* form = NULL;
+    while ((form = reader_next(&r)) != NULL) {
+        if (form->type == VALUE_ERROR) {
+            result = form;
+            break;
         }
 
-        free(content);
-        fclose(file);
+        cache_add(&c, form);
+        evaluate_loaded(form, env, counter);
+        value_dispose(form);
+    }
+
+    if (result == NULL && ferror(file)) {
+        result = value_new_error("error reading from file: %s", path);
+    }
+
+    if (result == NULL) {
+        cache_commit(&c);
+    } else {
+        cache_abort(&c);
+    }
+
+    reader_dispose(&r);
+    fclose(file);
+
+    return result;
+}
+
+static value* builtin_load(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_STRING, 0);
+
+    value* result = NULL;
+    size_t counter = 0;
+
+    cache c;
+    if (cache_open(&c, args[0]->symbol)) {
+        result = load_from_cache(&c, env, &counter);
+        cache_close(&c);
     } else {
-        result = value_new_error("failed to open file: %s", args[0]->symbol);
+        result = load_from_source(args[0]->symbol, env, &counter);
+    }
+
+    if (result == NULL) {
+        result = value_new_info(
+            "evaluated %zu expression%s",
+            counter, (counter > 1 ? "s" : ""));
     }
 
     return result;
 }
 
+static value* builtin_dump(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_STRING, 0);
+
+    if (!image_dump(env, args[0]->symbol)) {
+        return value_new_error("failed to dump image: %s", args[0]->symbol);
+    }
+
+    return value_new_info("dumped image: %s", args[0]->symbol);
+}
+
 static value* builtin_print(value** args, size_t num_args, char* name, environment* env) {
     ASSERT_MIN_NUM_ARGS(name, num_args, 1);
 
-    char buffer[1024];
+    FILE* output = environment_get_context(env)->output;
     for (size_t i = 0; i < num_args; i++) {
-        value_to_str(args[i], buffer);
-        printf("%s", buffer);
+        value_print(args[i], output);
         if (i < num_args - 1) {
-            printf(" ");
+            fputc(' ', output);
         }
     }
-    printf("\n");
+    fputc('\n', output);
 
     return value_new_sexpr();
 }
@@ -798,7 +1097,7 @@ static value* builtin_slen(value** args, size_t num_args, char* name, environmen
     ASSERT_NUM_ARGS(name, num_args, 1);
     ASSERT_ARG_TYPE(name, args[0], VALUE_STRING, 0);
 
-    return value_new_number(strlen(args[0]->symbol));
+    return value_new_integer(strlen(args[0]->symbol));
 }
 
 static value* call_lambda(value* lambda, value** args, size_t num_args, environment* env) {
@@ -838,86 +1137,1512 @@ static value* call_lambda(value* lambda, value** args, size_t num_args, environm
         }
     }
 
-    value* result = builtin_eval(&lambda->body, 1, name, &local);
+    // the body is evaluated in place (evaluating an s-expr doesn't
+    // change it), instead of copying it for every call
+    value body = *lambda->body;
+    body.type = VALUE_SEXPR;
+    value* result = value_evaluate(&body, &local);
 
     environment_dispose(&local);
 
     return result;
 }
 
-static int is_delayed_evaluation_function(value* fn) {
-    assert(fn->type == VALUE_FUNCTION);
+value* value_apply(value* fn, value** args, size_t num_args, environment* env) {
+    if (fn->type != VALUE_FUNCTION) {
+        return value_new_error("can't apply %s", get_value_type_name(fn->type));
+    }
 
-    if (fn->builtin == builtin_and ||
-        fn->builtin == builtin_or ||
-        fn->builtin == builtin_cond) {
-        return 1;
+    if (fn->builtin != NULL) {
+        return fn->builtin(args, num_args, fn->symbol, env);
     } else {
-        return 0;
+        return call_lambda(fn, args, num_args, env);
     }
 }
 
-value* value_evaluate(value* v, environment* env) {
-    if (v->type == VALUE_SEXPR) {
-        char buffer[1024];
-        value* result = NULL;
+#define FILE_BUFFER_SIZE 65536
 
-        value* temp = value_new_sexpr();
-        if (v->num_children == 0) {
-            return temp;
-        }
+static value* builtin_fopen(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 1);
+    ASSERT_MAX_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARGS_TYPE(name, args, VALUE_STRING, num_args, 0);
 
-        value* child = NULL;
-        if (result == NULL) {
-            child = value_evaluate(v->children[0], env);
-            if (child->type == VALUE_ERROR) {
-                result = child;
-            } else {
-                value_add_child(temp, child);
-            }
-        }
+    char* mode = (num_args > 1) ? args[1]->symbol : "r";
+    if (strcmp(mode, "r") != 0 && strcmp(mode, "w") != 0 && strcmp(mode, "a") != 0 &&
+        strcmp(mode, "r+") != 0 && strcmp(mode, "w+") != 0 && strcmp(mode, "a+") != 0) {
+        return value_new_error("%s: invalid mode: %s", name, mode);
+    }
 
-        if (result == NULL) {
-            if (v->num_children == 1) {
-                result = temp->children[0];
-                temp->children[0] = NULL;  // don't dispose
-            }
-        }
+    FILE* stream = fopen(args[0]->symbol, mode);
+    if (stream == NULL) {
+        return value_new_error("failed to open file: %s", args[0]->symbol);
+    }
+    setvbuf(stream, NULL, _IOFBF, FILE_BUFFER_SIZE);
 
-        value* fn = NULL;
-        if (result == NULL) {
-            fn = temp->children[0];
-            if (fn->type != VALUE_FUNCTION) {
-                value_to_str(v, buffer);
-                result = value_new_error("s-expr %s must start with a function", buffer);
-            }
-        }
+    return value_new_file(stream, args[0]->symbol, mode);
+}
 
-        if (result == NULL) {
-            for (size_t i = 1; i < v->num_children; i++) {
-                if (is_delayed_evaluation_function(fn)) {
-                    child = value_copy(v->children[i]);
-                } else {
-                    child = value_evaluate(v->children[i], env);
-                }
+static value* builtin_fclose(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FILE, 0);
+    ASSERT_FILE_OPEN(name, args[0], 0);
+
+    // the other copies of the value see the file closed too
+    int failed = (fclose(args[0]->file->stream) != 0);
+    args[0]->file->stream = NULL;
+    if (failed) {
+        return value_new_error("failed to close file: %s", args[0]->file->path);
+    }
 
-                if (child->type == VALUE_ERROR) {
-                    result = child;
-                    break;
-                } else {
-                    value_add_child(temp, child);
-                }
-            }
-        }
+    return value_new_sexpr();
+}
 
+static value* read_line(value* file, char* name) {
+    char* buffer = NULL;
+    size_t capacity = 0;
+    ssize_t length = getline(&buffer, &capacity, file->file->stream);
+
+    value* result;
+    if (length == -1) {
+        result = ferror(file->file->stream)
+                     ? value_new_error("%s: failed to read from file: %s", name, file->file->path)
+                     : value_new_qexpr();
+    } else {
+        if (length > 0 && buffer[length - 1] == '\n') {
+            buffer[length - 1] = '\0';
+        }
+        result = value_new_string(buffer);
+    }
+    free(buffer);
+
+    return result;
+}
+
+static value* builtin_freadline(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FILE, 0);
+    ASSERT_FILE_OPEN(name, args[0], 0);
+
+    return read_line(args[0], name);
+}
+
+static value* builtin_fread(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 1);
+    ASSERT_MAX_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FILE, 0);
+    ASSERT_FILE_OPEN(name, args[0], 0);
+
+    // the chunk is read up to the given size or to the end of the file
+    size_t size = SIZE_MAX;
+    if (num_args > 1) {
+        ASSERT_INDEX(name, args[1], 1);
+        if (args[1]->number < 1) {
+            return value_new_error("%s: arg #1 must be positive", name);
+        } else if (!(args[1]->number < (double)SIZE_MAX)) {
+            return value_new_error("%s: arg #1 is too large", name);
+        }
+        size = args[1]->number;
+    }
+
+    FILE* stream = args[0]->file->stream;
+    size_t length = 0;
+    size_t capacity = (size < FILE_BUFFER_SIZE) ? size : FILE_BUFFER_SIZE;
+    char* buffer = malloc(capacity + 1);
+    while (length < size) {
+        if (length == capacity) {
+            capacity = (capacity * 2 < size) ? capacity * 2 : size;
+            buffer = realloc(buffer, capacity + 1);
+        }
+
+        size_t r = fread(buffer + length, 1, capacity - length, stream);
+        length += r;
+        if (r == 0) {
+            break;
+        }
+    }
+    buffer[length] = '\0';
+
+    value* result;
+    if (ferror(stream)) {
+        result = value_new_error("%s: failed to read from file: %s", name, args[0]->file->path);
+    } else if (length == 0) {
+        result = value_new_qexpr();
+    } else {
+        result = value_new_string(buffer);
+    }
+    free(buffer);
+
+    return result;
+}
+
+static value* builtin_fwrite(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FILE, 0);
+    ASSERT_FILE_OPEN(name, args[0], 0);
+
+    // strings are written raw, other values as printed
+    FILE* stream = args[0]->file->stream;
+    for (size_t i = 1; i < num_args; i++) {
+        if (args[i]->type == VALUE_STRING) {
+            fputs(args[i]->symbol, stream);
+        } else {
+            value_print(args[i], stream);
+        }
+    }
+
+    if (ferror(stream)) {
+        clearerr(stream);
+        return value_new_error("%s: failed to write to file: %s", name, args[0]->file->path);
+    }
+
+    return value_new_sexpr();
+}
+
+static value* builtin_fflush(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FILE, 0);
+    ASSERT_FILE_OPEN(name, args[0], 0);
+
+    if (fflush(args[0]->file->stream) != 0) {
+        return value_new_error("%s: failed to write to file: %s", name, args[0]->file->path);
+    }
+
+    return value_new_sexpr();
+}
+
+static value* builtin_feach(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FILE, 0);
+    ASSERT_ARG_TYPE(name, args[1], VALUE_FUNCTION, 1);
+    ASSERT_FILE_OPEN(name, args[0], 0);
+
+    // the lines are passed to the function one by one, as
+    // they are read, and the number of lines is returned
+    size_t num_lines = 0;
+    while (1) {
+        value* line = read_line(args[0], name);
+        if (line->type != VALUE_STRING) {
+            if (line->type == VALUE_ERROR) {
+                return line;
+            }
+            value_dispose(line);
+            break;
+        }
+
+        value* result = value_apply(args[1], &line, 1, env);
+        value_dispose(line);
+        if (result->type == VALUE_ERROR) {
+            return result;
+        }
+        value_dispose(result);
+
+        num_lines++;
+
+        if (args[0]->file->stream == NULL) {
+            // closed by the function
+            break;
+        }
+    }
+
+    return value_new_integer(num_lines);
+}
+
+#define PARALLEL_CHUNKS_PER_THREAD 4
+
+// the function is applied by the chunks in snapshots of the
+// caller's environment: a snapshot is reused by the chunks running
+// one after another, and a def within one doesn't leak out
+typedef struct parallel_job {
+    value* fn;
+    value** items;
+    value** results;
+    size_t num_items;
+    size_t chunk_size;
+    size_t num_chunks;
+    size_t first_error;
+    environment* env;
+    environment** snapshots;
+    environment** free_snapshots;
+    size_t num_snapshots;
+    size_t num_free_snapshots;
+    size_t snapshots_capacity;
+    pthread_mutex_t mutex;
+} parallel_job;
+
+static void parallel_job_init(parallel_job* job, value* fn, value* list, environment* env) {
+    job->fn = fn;
+    job->items = list->children;
+    job->num_items = list->num_children;
+    job->results = calloc(list->num_children, sizeof(value*));
+    job->first_error = list->num_children;
+    job->env = env;
+
+    job->snapshots_capacity = pool_get_num_threads();
+    job->snapshots = malloc(job->snapshots_capacity * sizeof(environment*));
+    job->free_snapshots = malloc(job->snapshots_capacity * sizeof(environment*));
+    job->num_snapshots = 0;
+    job->num_free_snapshots = 0;
+    pthread_mutex_init(&job->mutex, NULL);
+
+    // a few chunks per thread balance the load
+    size_t max_chunks = pool_get_num_threads() * PARALLEL_CHUNKS_PER_THREAD;
+    job->chunk_size = (job->num_items + max_chunks - 1) / max_chunks;
+    if (job->chunk_size == 0) {
+        job->chunk_size = 1;
+    }
+    job->num_chunks = (job->num_items + job->chunk_size - 1) / job->chunk_size;
+}
+
+static void parallel_job_dispose(parallel_job* job) {
+    for (size_t i = 0; i < job->num_items; i++) {
+        if (job->results[i] != NULL) {
+            value_dispose(job->results[i]);
+        }
+    }
+    free(job->results);
+
+    for (size_t i = 0; i < job->num_snapshots; i++) {
+        environment_dispose(job->snapshots[i]);
+        free(job->snapshots[i]);
+    }
+    free(job->snapshots);
+    free(job->free_snapshots);
+
+    pthread_mutex_destroy(&job->mutex);
+}
+
+static environment* acquire_snapshot(parallel_job* job) {
+    environment* snapshot = NULL;
+
+    pthread_mutex_lock(&job->mutex);
+    if (job->num_free_snapshots > 0) {
+        snapshot = job->free_snapshots[--job->num_free_snapshots];
+    }
+    pthread_mutex_unlock(&job->mutex);
+
+    if (snapshot == NULL) {
+        snapshot = malloc(sizeof(environment));
+        environment_snapshot(snapshot, job->env);
+
+        pthread_mutex_lock(&job->mutex);
+        if (job->num_snapshots == job->snapshots_capacity) {
+            // more threads than in the pool can run nested jobs
+            job->snapshots_capacity *= 2;
+            job->snapshots = realloc(job->snapshots, job->snapshots_capacity * sizeof(environment*));
+            job->free_snapshots = realloc(job->free_snapshots, job->snapshots_capacity * sizeof(environment*));
+        }
+        job->snapshots[job->num_snapshots++] = snapshot;
+        pthread_mutex_unlock(&job->mutex);
+    }
+
+    return snapshot;
+}
+
+static void release_snapshot(parallel_job* job, environment* snapshot) {
+    pthread_mutex_lock(&job->mutex);
+    job->free_snapshots[job->num_free_snapshots++] = snapshot;
+    pthread_mutex_unlock(&job->mutex);
+}
+
+static size_t get_first_error(parallel_job* job) {
+    pthread_mutex_lock(&job->mutex);
+    size_t first_error = job->first_error;
+    pthread_mutex_unlock(&job->mutex);
+
+    return first_error;
+}
+
+static void set_first_error(parallel_job* job, size_t index) {
+    pthread_mutex_lock(&job->mutex);
+    if (index < job->first_error) {
+        job->first_error = index;
+    }
+    pthread_mutex_unlock(&job->mutex);
+}
+
+static void run_map_chunk(void* arg, size_t index) {
+    parallel_job* job = arg;
+
+    size_t begin = index * job->chunk_size;
+    size_t end = begin + job->chunk_size;
+    if (end > job->num_items) {
+        end = job->num_items;
+    }
+
+    // the chunks past an error found already are skipped
+    if (begin > get_first_error(job)) {
+        return;
+    }
+
+    environment* snapshot = acquire_snapshot(job);
+    for (size_t i = begin; i < end; i++) {
+        value* result = value_apply(job->fn, &job->items[i], 1, snapshot);
+        job->results[i] = result;
+        if (result->type == VALUE_ERROR) {
+            set_first_error(job, i);
+            break;
+        }
+    }
+    release_snapshot(job, snapshot);
+}
+
+static value* builtin_pmap(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FUNCTION, 0);
+    ASSERT_ARG_TYPE(name, args[1], VALUE_QEXPR, 1);
+
+    parallel_job job;
+    parallel_job_init(&job, args[0], args[1], env);
+    pool_run(run_map_chunk, &job, job.num_chunks);
+
+    // the error of the lowest index wins, as if
+    // the items were mapped one after another
+    value* result;
+    if (job.first_error < job.num_items) {
+        result = job.results[job.first_error];
+        job.results[job.first_error] = NULL;
+    } else {
+        // the results are moved into the q-expr
+        result = value_new_qexpr();
+        if (job.num_items > 0) {
+            free(result->children);
+            result->children = job.results;
+            result->num_children = job.num_items;
+            result->capacity = job.num_items;
+            job.results = NULL;
+            job.num_items = 0;
+        }
+    }
+
+    parallel_job_dispose(&job);
+
+    return result;
+}
+
+// the partial results of the native reduction follow the same
+// promotion from integers to doubles as the arithmetic builtins
+typedef struct reduce_number {
+    int is_integer;
+    int64_t integer;
+    double number;
+} reduce_number;
+
+typedef struct reduce_job {
+    parallel_job base;
+    value* identity;
+    integer_op iop;
+    double_op dop;
+    reduce_number* numbers;
+    int not_numeric;
+    size_t stride;
+} reduce_job;
+
+static int get_reduce_ops(value* fn, value* identity, integer_op* iop, double_op* dop) {
+    if (!value_is_number(identity)) {
+        return 0;
+    } else if (fn->builtin == builtin_add) {
+        *iop = add_integers;
+        *dop = add_doubles;
+    } else if (fn->builtin == builtin_multiply) {
+        *iop = multiply_integers;
+        *dop = multiply_doubles;
+    } else if (fn->builtin == builtin_minimum) {
+        *iop = minimum_integers;
+        *dop = minimum_doubles;
+    } else if (fn->builtin == builtin_maximum) {
+        *iop = maximum_integers;
+        *dop = maximum_doubles;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+static reduce_number get_reduce_number(value* v) {
+    reduce_number number = {v->type == VALUE_INTEGER, v->integer, v->number};
+    return number;
+}
+
+static void reduce_numbers(integer_op iop, double_op dop, reduce_number* acc, reduce_number other) {
+    if (acc->is_integer && other.is_integer) {
+        int64_t next;
+        if (iop(acc->integer, other.integer, &next)) {
+            acc->integer = next;
+            return;
+        }
+    }
+
+    double number = acc->is_integer ? acc->integer : acc->number;
+    acc->number = dop(number, other.is_integer ? other.integer : other.number);
+    acc->is_integer = 0;
+}
+
+static void run_native_reduce_chunk(void* arg, size_t index) {
+    reduce_job* job = arg;
+
+    size_t begin = index * job->base.chunk_size;
+    size_t end = begin + job->base.chunk_size;
+    if (end > job->base.num_items) {
+        end = job->base.num_items;
+    }
+
+    reduce_number acc = get_reduce_number(job->identity);
+    for (size_t i = begin; i < end; i++) {
+        value* item = job->base.items[i];
+        if (!value_is_number(item)) {
+            // the generic path reports the error
+            pthread_mutex_lock(&job->base.mutex);
+            job->not_numeric = 1;
+            pthread_mutex_unlock(&job->base.mutex);
+            return;
+        }
+        reduce_numbers(job->iop, job->dop, &acc, get_reduce_number(item));
+    }
+    job->numbers[index] = acc;
+}
+
+static void run_reduce_chunk(void* arg, size_t index) {
+    reduce_job* job = arg;
+
+    size_t begin = index * job->base.chunk_size;
+    size_t end = begin + job->base.chunk_size;
+    if (end > job->base.num_items) {
+        end = job->base.num_items;
+    }
+
+    // the chunks past an error found already are skipped
+    if (begin > get_first_error(&job->base)) {
+        return;
+    }
+
+    environment* snapshot = acquire_snapshot(&job->base);
+    value* acc = value_copy(job->identity);
+    for (size_t i = begin; i < end; i++) {
+        value* pair[2] = {acc, job->base.items[i]};
+        value* result = value_apply(job->base.fn, pair, 2, snapshot);
+        value_dispose(acc);
+        acc = result;
+        if (acc->type == VALUE_ERROR) {
+            set_first_error(&job->base, i);
+            break;
+        }
+    }
+    release_snapshot(&job->base, snapshot);
+
+    // the partial results of the chunks are kept
+    // at the chunk indices of the results array
+    job->base.results[index] = acc;
+}
+
+static void run_reduce_pair(void* arg, size_t index) {
+    reduce_job* job = arg;
+
+    size_t left = 2 * index * job->stride;
+    size_t right = left + job->stride;
+    if (right >= job->base.num_chunks) {
+        return;
+    }
+
+    value** results = job->base.results;
+    if (results[left]->type == VALUE_ERROR) {
+        // the error on the left wins
+    } else if (results[right]->type == VALUE_ERROR) {
+        value_dispose(results[left]);
+        results[left] = results[right];
+        results[right] = NULL;
+    } else {
+        value* pair[2] = {results[left], results[right]};
+        environment* snapshot = acquire_snapshot(&job->base);
+        value* result = value_apply(job->base.fn, pair, 2, snapshot);
+        release_snapshot(&job->base, snapshot);
+
+        value_dispose(results[left]);
+        value_dispose(results[right]);
+        results[left] = result;
+        results[right] = NULL;
+    }
+}
+
+static value* builtin_preduce(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 3);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FUNCTION, 0);
+    ASSERT_ARG_TYPE(name, args[2], VALUE_QEXPR, 2);
+
+    if (args[2]->num_children == 0) {
+        return value_copy(args[1]);
+    }
+
+    reduce_job job;
+    parallel_job_init(&job.base, args[0], args[2], env);
+    job.identity = args[1];
+    job.numbers = NULL;
+    job.not_numeric = 0;
+
+    value* result = NULL;
+    if (get_reduce_ops(args[0], args[1], &job.iop, &job.dop)) {
+        // the numbers are reduced without boxing the partial results
+        job.numbers = malloc(job.base.num_chunks * sizeof(reduce_number));
+        pool_run(run_native_reduce_chunk, &job, job.base.num_chunks);
+
+        if (!job.not_numeric) {
+            reduce_number acc = job.numbers[0];
+            for (size_t i = 1; i < job.base.num_chunks; i++) {
+                reduce_numbers(job.iop, job.dop, &acc, job.numbers[i]);
+            }
+            result = acc.is_integer ? value_new_integer(acc.integer) : value_new_number(acc.number);
+        }
+        free(job.numbers);
+    }
+
+    if (result == NULL) {
+        pool_run(run_reduce_chunk, &job, job.base.num_chunks);
+
+        if (job.base.first_error < job.base.num_items) {
+            // the error of the lowest index wins
+            size_t chunk = job.base.first_error / job.base.chunk_size;
+            result = job.base.results[chunk];
+            job.base.results[chunk] = NULL;
+        } else {
+            // the partial results are combined pairwise in a tree,
+            // keeping their order for non-commutative functions
+            for (job.stride = 1; job.stride < job.base.num_chunks; job.stride *= 2) {
+                size_t num_pairs = (job.base.num_chunks + 2 * job.stride - 1) / (2 * job.stride);
+                pool_run(run_reduce_pair, &job, num_pairs);
+            }
+            result = job.base.results[0];
+            job.base.results[0] = NULL;
+        }
+    }
+
+    parallel_job_dispose(&job.base);
+
+    return result;
+}
+
+static value* builtin_map(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FUNCTION, 0);
+    ASSERT_ARG_TYPE(name, args[1], VALUE_QEXPR, 1);
+
+    // the items are passed without copying (the builtins borrow
+    // their arguments, and the lambdas copy them into their frames)
+    value* result = value_new_qexpr();
+    if (args[1]->num_children > result->capacity) {
+        result->capacity = args[1]->num_children;
+        result->children = realloc(result->children, result->capacity * sizeof(value*));
+    }
+    for (size_t i = 0; i < args[1]->num_children; i++) {
+        value* item = value_apply(args[0], &args[1]->children[i], 1, env);
+        if (item->type == VALUE_ERROR) {
+            value_dispose(result);
+            return item;
+        }
+        value_add_child(result, item);
+    }
+
+    return result;
+}
+
+static value* builtin_filter(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FUNCTION, 0);
+    ASSERT_ARG_TYPE(name, args[1], VALUE_QEXPR, 1);
+
+    value* result = value_new_qexpr();
+    for (size_t i = 0; i < args[1]->num_children; i++) {
+        value* kept = value_apply(args[0], &args[1]->children[i], 1, env);
+        if (kept->type != VALUE_ERROR) {
+            value* truth = value_to_bool(kept);
+            value_dispose(kept);
+            kept = truth;
+        }
+
+        if (kept->type == VALUE_ERROR) {
+            value_dispose(result);
+            return kept;
+        } else if (kept->number == 1) {
+            value_add_child(result, value_copy(args[1]->children[i]));
+        }
+        value_dispose(kept);
+    }
+
+    return result;
+}
+
+// the numbers are folded without boxing the partial results,
+// returning NULL if any item isn't a number
+static value* fold_numbers_natively(value* fn, value* init, value* list, int right) {
+    integer_op iop;
+    double_op dop;
+    if (!get_reduce_ops(fn, init, &iop, &dop)) {
+        return NULL;
+    }
+
+    // the functions are commutative, but the order of the items
+    // still matters: the doubles are rounded, and the integers
+    // are promoted to doubles on overflow, at every step
+    reduce_number acc = get_reduce_number(init);
+    size_t num_items = list->num_children;
+    for (size_t i = 0; i < num_items; i++) {
+        value* item = list->children[right ? num_items - 1 - i : i];
+        if (!value_is_number(item)) {
+            return NULL;
+        }
+        reduce_numbers(iop, dop, &acc, get_reduce_number(item));
+    }
+
+    return acc.is_integer ? value_new_integer(acc.integer) : value_new_number(acc.number);
+}
+
+static value* fold(value** args, size_t num_args, char* name, environment* env, int right) {
+    ASSERT_NUM_ARGS(name, num_args, 3);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FUNCTION, 0);
+    ASSERT_ARG_TYPE(name, args[2], VALUE_QEXPR, 2);
+
+    value* result = fold_numbers_natively(args[0], args[1], args[2], right);
+    if (result != NULL) {
+        return result;
+    }
+
+    // foldl calls (fn acc item) from the first item on,
+    // and foldr calls (fn item acc) from the last one on
+    value* acc = value_copy(args[1]);
+    size_t num_items = args[2]->num_children;
+    for (size_t i = 0; i < num_items; i++) {
+        value* item = args[2]->children[right ? num_items - 1 - i : i];
+        value* pair[2] = {right ? item : acc, right ? acc : item};
+        value* next = value_apply(args[0], pair, 2, env);
+        value_dispose(acc);
+        acc = next;
+        if (acc->type == VALUE_ERROR) {
+            break;
+        }
+    }
+
+    return acc;
+}
+
+static value* builtin_foldl(value** args, size_t num_args, char* name, environment* env) {
+    return fold(args, num_args, name, env, 0);
+}
+
+static value* builtin_foldr(value** args, size_t num_args, char* name, environment* env) {
+    return fold(args, num_args, name, env, 1);
+}
+
+// the lists long enough are sorted by the pool threads
+#define SORT_PARALLEL_LENGTH 4096
+
+// the default order is the one of value_order, and so is
+// the one of < and > (reversed), without applying them
+typedef struct sort_context {
+    value* fn;
+    int reversed;
+    environment* env;
+    value* error;
+} sort_context;
+
+static int less_by_order(value* v1, value* v2, void* context) {
+    sort_context* c = context;
+    if (c->error != NULL) {
+        return 0;
+    }
+
+    int order = value_order(v1, v2, &c->error);
+    return c->reversed ? (order > 0) : (order < 0);
+}
+
+// the comparisons stop at the first error, leaving the rest of
+// the items in any order, as the sorted list is dropped anyway
+static int less_by_fn(value* v1, value* v2, void* context) {
+    sort_context* c = context;
+    if (c->error != NULL) {
+        return 0;
+    }
+
+    value* pair[2] = {v1, v2};
+    value* result = value_apply(c->fn, pair, 2, c->env);
+    if (result->type != VALUE_ERROR) {
+        value* truth = value_to_bool(result);
+        value_dispose(result);
+        result = truth;
+    }
+
+    int less = 0;
+    if (result->type == VALUE_ERROR) {
+        c->error = result;
+    } else {
+        less = (result->number == 1);
+        value_dispose(result);
+    }
+
+    return less;
+}
+
+static sort_less init_sort_context(sort_context* c, value* fn, environment* env) {
+    c->fn = fn;
+    c->reversed = 0;
+    c->env = env;
+    c->error = NULL;
+
+    if (fn == NULL || fn->builtin == builtin_lt) {
+        return less_by_order;
+    } else if (fn->builtin == builtin_gt) {
+        c->reversed = 1;
+        return less_by_order;
+    } else {
+        return less_by_fn;
+    }
+}
+
+// a piece of a merge, which the merge path makes independent
+// of the others: the merges of a round are split in as many
+// pieces as there are chunks, to keep the threads busy in
+// the last rounds merging a couple of long runs
+typedef struct merge_piece {
+    size_t left;
+    size_t left_length;
+    size_t right;
+    size_t right_length;
+    size_t out;
+} merge_piece;
+
+// the results array of the job is the buffer of the merges,
+// which go back and forth between it and the items
+typedef struct sort_job {
+    parallel_job base;
+    int stable;
+    value** from;
+    value** to;
+    merge_piece* pieces;
+    value* error;
+} sort_job;
+
+static sort_less acquire_sort_context(sort_job* job, sort_context* c) {
+    sort_less less = init_sort_context(c, job->base.fn, NULL);
+    if (less == less_by_fn) {
+        c->env = acquire_snapshot(&job->base);
+    }
+
+    return less;
+}
+
+static void release_sort_context(sort_job* job, sort_context* c) {
+    if (c->env != NULL) {
+        release_snapshot(&job->base, c->env);
+    }
+
+    pthread_mutex_lock(&job->base.mutex);
+    if (c->error != NULL && job->error == NULL) {
+        job->error = c->error;
+    } else if (c->error != NULL) {
+        value_dispose(c->error);
+    }
+    pthread_mutex_unlock(&job->base.mutex);
+}
+
+static int sort_job_failed(sort_job* job) {
+    pthread_mutex_lock(&job->base.mutex);
+    int failed = (job->error != NULL);
+    pthread_mutex_unlock(&job->base.mutex);
+
+    return failed;
+}
+
+static void run_sort_chunk(void* arg, size_t index) {
+    sort_job* job = arg;
+
+    size_t begin = index * job->base.chunk_size;
+    size_t end = begin + job->base.chunk_size;
+    if (end > job->base.num_items) {
+        end = job->base.num_items;
+    }
+
+    if (sort_job_failed(job)) {
+        return;
+    }
+
+    sort_context context;
+    sort_less less = acquire_sort_context(job, &context);
+    if (job->stable) {
+        sort_values_stable(job->from + begin, job->to + begin, end - begin, less, &context);
+    } else {
+        sort_values(job->from + begin, end - begin, less, &context);
+    }
+    release_sort_context(job, &context);
+}
+
+static void run_merge_piece(void* arg, size_t index) {
+    sort_job* job = arg;
+    merge_piece* piece = &job->pieces[index];
+
+    value** left = job->from + piece->left;
+    value** right = job->from + piece->right;
+    value** out = job->to + piece->out;
+
+    if (sort_job_failed(job)) {
+        // the items are only moved, to keep them all
+        memcpy(out, left, piece->left_length * sizeof(value*));
+        memcpy(out + piece->left_length, right, piece->right_length * sizeof(value*));
+        return;
+    }
+
+    sort_context context;
+    sort_less less = acquire_sort_context(job, &context);
+    sort_merge(left, piece->left_length, right, piece->right_length, out, less, &context);
+    release_sort_context(job, &context);
+}
+
+// splits the merges of the runs of the width in pieces,
+// returning their number
+static size_t split_merges(sort_job* job, size_t width) {
+    size_t num_items = job->base.num_items;
+    size_t num_pairs = (num_items + 2 * width - 1) / (2 * width);
+    size_t num_pieces = job->base.num_chunks / num_pairs;
+    if (num_pieces == 0) {
+        num_pieces = 1;
+    }
+
+    sort_context context;
+    sort_less less = acquire_sort_context(job, &context);
+
+    merge_piece* piece = job->pieces;
+    for (size_t p = 0; p < num_pairs; p++) {
+        size_t left = 2 * p * width;
+        size_t left_length = (num_items - left < width) ? num_items - left : width;
+        size_t right = left + left_length;
+        size_t right_length = (num_items - right < width) ? num_items - right : width;
+        size_t length = left_length + right_length;
+
+        size_t previous_split = 0;
+        size_t previous_diagonal = 0;
+        for (size_t k = 1; k <= num_pieces; k++) {
+            size_t diagonal = length * k / num_pieces;
+            size_t split = sort_split(
+                job->from + left, left_length,
+                job->from + right, right_length,
+                diagonal, less, &context);
+
+            // the inconsistent comparisons may give the splits
+            // out of order, but the pieces can't overlap
+            if (split < previous_split) {
+                split = previous_split;
+            } else if (split > previous_split + (diagonal - previous_diagonal)) {
+                split = previous_split + (diagonal - previous_diagonal);
+            }
+
+            piece->left = left + previous_split;
+            piece->left_length = split - previous_split;
+            piece->right = right + (previous_diagonal - previous_split);
+            piece->right_length = (diagonal - split) - (previous_diagonal - previous_split);
+            piece->out = left + previous_diagonal;
+            piece++;
+
+            previous_split = split;
+            previous_diagonal = diagonal;
+        }
+    }
+
+    release_sort_context(job, &context);
+
+    return piece - job->pieces;
+}
+
+// the chunks are sorted first, and then merged in rounds,
+// doubling the width of the sorted runs in each one
+static value* sort_in_parallel(value* list, value* fn, environment* env, int stable) {
+    sort_job job;
+    parallel_job_init(&job.base, fn, list, env);
+    job.stable = stable;
+    job.from = list->children;
+    job.to = job.base.results;
+    job.pieces = malloc(job.base.num_chunks * sizeof(merge_piece));
+    job.error = NULL;
+
+    pool_run(run_sort_chunk, &job, job.base.num_chunks);
+
+    for (size_t width = job.base.chunk_size; width < job.base.num_items; width *= 2) {
+        size_t num_pieces = split_merges(&job, width);
+        pool_run(run_merge_piece, &job, num_pieces);
+
+        value** temp = job.from;
+        job.from = job.to;
+        job.to = temp;
+    }
+
+    if (job.from != list->children) {
+        memcpy(list->children, job.from, job.base.num_items * sizeof(value*));
+    }
+
+    // the buffer holds no results to dispose
+    job.base.num_items = 0;
+    parallel_job_dispose(&job.base);
+    free(job.pieces);
+
+    return job.error;
+}
+
+static value* sort_list(value** args, size_t num_args, char* name, environment* env, int stable) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 1);
+    ASSERT_MAX_NUM_ARGS(name, num_args, 2);
+
+    // the comparison function (if given) comes first
+    value* fn = NULL;
+    if (num_args > 1) {
+        ASSERT_ARG_TYPE(name, args[0], VALUE_FUNCTION, 0);
+        fn = args[0];
+    }
+    ASSERT_ARG_TYPE(name, args[num_args - 1], VALUE_QEXPR, (int)num_args - 1);
+
+    // the items are sorted in place in a copy of the list
+    value* result = value_copy(args[num_args - 1]);
+    size_t length = result->num_children;
+
+    value* error;
+    if (length >= SORT_PARALLEL_LENGTH && pool_get_num_threads() > 1) {
+        error = sort_in_parallel(result, fn, env, stable);
+    } else {
+        sort_context context;
+        sort_less less = init_sort_context(&context, fn, env);
+        if (stable) {
+            value** buffer = malloc((length / 2 + 1) * sizeof(value*));
+            sort_values_stable(result->children, buffer, length, less, &context);
+            free(buffer);
+        } else {
+            sort_values(result->children, length, less, &context);
+        }
+        error = context.error;
+    }
+
+    if (error != NULL) {
+        value_dispose(result);
+        return error;
+    }
+
+    return result;
+}
+
+static value* builtin_sort(value** args, size_t num_args, char* name, environment* env) {
+    return sort_list(args, num_args, name, env, 0);
+}
+
+static value* builtin_stable_sort(value** args, size_t num_args, char* name, environment* env) {
+    return sort_list(args, num_args, name, env, 1);
+}
+
+static value* builtin_future(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_QEXPR, 0);
+
+    return future_start(args[0], env);
+}
+
+static value* builtin_await(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FUTURE, 0);
+
+    return future_await(args[0]->future);
+}
+
+static value* builtin_spawn(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_QEXPR, 0);
+
+    return future_spawn(args[0], env);
+}
+
+static value* builtin_sync(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_FUTURE, 0);
+
+    return future_sync(args[0]->future);
+}
+
+static value* builtin_chan(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MAX_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
+
+    double capacity = (num_args > 0) ? args[0]->number : 1;
+    if (!(capacity >= 1)) {
+        return value_new_error("%s: capacity must be positive", name);
+    } else if (!(capacity < (double)SIZE_MAX)) {
+        return value_new_error("%s: capacity is too large", name);
+    }
+
+    value* result = channel_new(capacity);
+    if (result == NULL) {
+        return value_new_error("%s: can't allocate a channel of %zu values", name, (size_t)capacity);
+    }
+
+    return result;
+}
+
+static value* builtin_send(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_CHANNEL, 0);
+
+    // the arguments are borrowed, so the value is copied once
+    // here, and the receiver takes it without another copy
+    value* v = value_copy(args[1]);
+    if (!channel_send(args[0]->channel, v)) {
+        value_dispose(v);
+        return value_new_error("%s: channel is closed", name);
+    }
+
+    return value_new_sexpr();
+}
+
+static value* builtin_receive(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_CHANNEL, 0);
+
+    // a closed channel yields {} when drained, like a file at its end
+    value* v = channel_receive(args[0]->channel);
+
+    return (v != NULL) ? v : value_new_qexpr();
+}
+
+static value* builtin_close(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_CHANNEL, 0);
+
+    if (!channel_close(args[0]->channel)) {
+        return value_new_error("%s: channel is closed already", name);
+    }
+
+    return value_new_sexpr();
+}
+
+static value* builtin_select(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARGS_TYPE(name, args, VALUE_CHANNEL, num_args, 0);
+
+    value_channel** channels = malloc(num_args * sizeof(value_channel*));
+    for (size_t i = 0; i < num_args; i++) {
+        channels[i] = args[i]->channel;
+    }
+
+    // the channel received from and the value, or {} once
+    // all the channels are closed and drained
+    size_t index;
+    value* v;
+    int received = channel_select(channels, num_args, &index, &v);
+    free(channels);
+
+    value* result = value_new_qexpr();
+    if (received) {
+        value_add_child(result, value_new_integer(index));
+        value_add_child(result, v);
+    }
+
+    return result;
+}
+
+static value* new_array(size_t length, char* name) {
+    value* result = array_new(length);
+    if (result == NULL) {
+        return value_new_error("%s: can't allocate an array of %zu numbers", name, length);
+    }
+
+    return result;
+}
+
+static value* builtin_array(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_QEXPR, 0);
+    ASSERT_EXPR_CHILDREN_TYPE(name, args[0], VALUE_NUMBER, 0);
+
+    value* result = new_array(args[0]->num_children, name);
+    if (result->type == VALUE_ARRAY) {
+        for (size_t i = 0; i < args[0]->num_children; i++) {
+            result->array->data[i] = args[0]->children[i]->number;
+        }
+    }
+
+    return result;
+}
+
+static value* builtin_arange(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 1);
+    ASSERT_MAX_NUM_ARGS(name, num_args, 3);
+    ASSERT_ARGS_TYPE(name, args, VALUE_NUMBER, num_args, 0);
+
+    // like the ranges of numpy: [start, stop) by step
+    double start = (num_args > 1) ? args[0]->number : 0;
+    double stop = (num_args > 1) ? args[1]->number : args[0]->number;
+    double step = (num_args > 2) ? args[2]->number : 1;
+    if (step == 0) {
+        return value_new_error("%s: step must be non-zero", name);
+    }
+
+    double count = ceil((stop - start) / step);
+    if (!(count < (double)SIZE_MAX)) {
+        return value_new_error("%s: range is too long", name);
+    }
+
+    size_t length = (count > 0) ? count : 0;
+    value* result = new_array(length, name);
+    if (result->type == VALUE_ARRAY) {
+        for (size_t i = 0; i < length; i++) {
+            result->array->data[i] = start + i * step;
+        }
+    }
+
+    return result;
+}
+
+static value* builtin_vlist(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_ARRAY, 0);
+
+    value* result = value_new_qexpr();
+    for (size_t i = 0; i < args[0]->array->length; i++) {
+        value_add_child(result, value_new_number(args[0]->array->data[i]));
+    }
+
+    return result;
+}
+
+static value* builtin_vslice(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 2);
+    ASSERT_MAX_NUM_ARGS(name, num_args, 3);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_ARRAY, 0);
+    for (size_t i = 1; i < num_args; i++) {
+        ASSERT_INDEX(name, args[i], i);
+    }
+
+    // the slice [start, end) shares the elements with the array
+    size_t length = args[0]->array->length;
+    double start = args[1]->number;
+    double end = (num_args > 2) ? args[2]->number : length;
+    if (start < 0 || start > end || end > length) {
+        return value_new_error(
+            "%s: slice [%g, %g) is out of the range of %zu numbers",
+            name, start, end, length);
+    }
+
+    return array_slice(args[0]->array, start, end);
+}
+
+static value* builtin_array_op(value** args, size_t num_args, char* name, array_op op) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+
+    // either of the operands may be a number, applied to all elements
+    for (size_t i = 0; i < 2; i++) {
+        if (args[i]->type != VALUE_ARRAY) {
+            ASSERT_ARG_TYPE(name, args[i], VALUE_NUMBER, i);
+        }
+    }
+    if (args[0]->type != VALUE_ARRAY && args[1]->type != VALUE_ARRAY) {
+        return value_new_error("%s: one of the args must be an array", name);
+    }
+
+    value_array* a = (args[0]->type == VALUE_ARRAY) ? args[0]->array : args[1]->array;
+    if (args[0]->type == VALUE_ARRAY && args[1]->type == VALUE_ARRAY &&
+        args[0]->array->length != args[1]->array->length) {
+        return value_new_error(
+            "%s: arrays must be of the same length, but got %zu and %zu",
+            name, args[0]->array->length, args[1]->array->length);
+    }
+
+    value* result = new_array(a->length, name);
+    if (result->type == VALUE_ARRAY) {
+        double* out = result->array->data;
+        if (args[0]->type != VALUE_ARRAY) {
+            array_apply_scalar(op, out, a->data, args[0]->number, a->length, 1);
+        } else if (args[1]->type != VALUE_ARRAY) {
+            array_apply_scalar(op, out, a->data, args[1]->number, a->length, 0);
+        } else {
+            array_apply(op, out, args[0]->array->data, args[1]->array->data, a->length);
+        }
+    }
+
+    return result;
+}
+
+// unlike / on numbers, dividing by zero yields infinities (or NaNs)
+static value* builtin_vadd(value** args, size_t num_args, char* name, environment* env) {
+    return builtin_array_op(args, num_args, name, ARRAY_ADD);
+}
+
+static value* builtin_vsubtract(value** args, size_t num_args, char* name, environment* env) {
+    return builtin_array_op(args, num_args, name, ARRAY_SUBTRACT);
+}
+
+static value* builtin_vmultiply(value** args, size_t num_args, char* name, environment* env) {
+    return builtin_array_op(args, num_args, name, ARRAY_MULTIPLY);
+}
+
+static value* builtin_vdivide(value** args, size_t num_args, char* name, environment* env) {
+    return builtin_array_op(args, num_args, name, ARRAY_DIVIDE);
+}
+
+static value* builtin_vsum(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_ARRAY, 0);
+
+    return value_new_number(array_sum(args[0]->array->data, args[0]->array->length));
+}
+
+static value* builtin_vdot(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARGS_TYPE(name, args, VALUE_ARRAY, num_args, 0);
+    if (args[0]->array->length != args[1]->array->length) {
+        return value_new_error(
+            "%s: arrays must be of the same length, but got %zu and %zu",
+            name, args[0]->array->length, args[1]->array->length);
+    }
+
+    return value_new_number(array_dot(args[0]->array->data, args[1]->array->data, args[0]->array->length));
+}
+
+static value* builtin_array_extremum(value** args, size_t num_args, char* name,
+                                     double (*extremum)(double*, size_t)) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_ARRAY, 0);
+    if (args[0]->array->length == 0) {
+        return value_new_error("%s: arg #0 ([]) must be non-empty", name);
+    }
+
+    return value_new_number(extremum(args[0]->array->data, args[0]->array->length));
+}
+
+static value* builtin_vmin(value** args, size_t num_args, char* name, environment* env) {
+    return builtin_array_extremum(args, num_args, name, array_min);
+}
+
+static value* builtin_vmax(value** args, size_t num_args, char* name, environment* env) {
+    return builtin_array_extremum(args, num_args, name, array_max);
+}
+
+static value* builtin_hmap(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_QEXPR, 0);
+    ASSERT_EXPR_CHILDREN_TYPE(name, args[0], VALUE_QEXPR, 0);
+
+    // the map is made of {key value} pairs, like the ones of hitems
+    for (size_t i = 0; i < args[0]->num_children; i++) {
+        value* pair = args[0]->children[i];
+        ASSERT_ARG_LENGTH(name, pair, 2, 0);
+        ASSERT_HASHABLE(name, pair->children[0], 0);
+    }
+
+    value* result = map_new();
+    for (size_t i = 0; i < args[0]->num_children; i++) {
+        value* pair = args[0]->children[i];
+        map_put(result->map, value_copy(pair->children[0]), value_copy(pair->children[1]));
+    }
+
+    return result;
+}
+
+static value* builtin_hget(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_MIN_NUM_ARGS(name, num_args, 2);
+    ASSERT_MAX_NUM_ARGS(name, num_args, 3);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_MAP, 0);
+    ASSERT_HASHABLE(name, args[1], 1);
+
+    // the default is returned for a missing key, if given
+    value* result = map_get(args[0]->map, args[1]);
+    if (result == NULL) {
+        if (num_args > 2) {
+            return value_copy(args[2]);
+        }
+
+        char buffer[1024];
+        value_to_str(args[1], buffer);
+        return value_new_error("%s: key not found: %s", name, buffer);
+    }
+
+    return result;
+}
+
+static value* builtin_hput(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 3);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_MAP, 0);
+    ASSERT_HASHABLE(name, args[1], 1);
+    if (map_is_reachable(args[0]->map, args[2])) {
+        return value_new_error("%s: arg #2 must not contain the map itself", name);
+    }
+
+    // the map is changed in place (and shared by its copies),
+    // and returned for the calls to be chained
+    map_put(args[0]->map, value_copy(args[1]), value_copy(args[2]));
+
+    return value_copy(args[0]);
+}
+
+static value* builtin_hdel(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_MAP, 0);
+    ASSERT_HASHABLE(name, args[1], 1);
+
+    if (!map_delete(args[0]->map, args[1])) {
+        char buffer[1024];
+        value_to_str(args[1], buffer);
+        return value_new_error("%s: key not found: %s", name, buffer);
+    }
+
+    return value_copy(args[0]);
+}
+
+static value* builtin_hhas(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 2);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_MAP, 0);
+    ASSERT_HASHABLE(name, args[1], 1);
+
+    value* v = map_get(args[0]->map, args[1]);
+    if (v == NULL) {
+        return value_new_bool(0);
+    }
+
+    value_dispose(v);
+    return value_new_bool(1);
+}
+
+// the entries are listed in the order of insertion
+static value* builtin_hitems(value** args, size_t num_args, char* name, environment* env) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_MAP, 0);
+
+    return map_items(args[0]->map);
+}
+
+static value* get_map_column(value** args, size_t num_args, char* name, size_t column) {
+    ASSERT_NUM_ARGS(name, num_args, 1);
+    ASSERT_ARG_TYPE(name, args[0], VALUE_MAP, 0);
+
+    value* result = map_items(args[0]->map);
+    for (size_t i = 0; i < result->num_children; i++) {
+        value* pair = result->children[i];
+        result->children[i] = pair->children[column];
+        pair->children[column] = NULL;  // don't dispose
+        value_dispose(pair);
+    }
+
+    return result;
+}
+
+static value* builtin_hkeys(value** args, size_t num_args, char* name, environment* env) {
+    return get_map_column(args, num_args, name, 0);
+}
+
+static value* builtin_hvals(value** args, size_t num_args, char* name, environment* env) {
+    return get_map_column(args, num_args, name, 1);
+}
+
+static int is_delayed_evaluation_function(value* fn) {
+    assert(fn->type == VALUE_FUNCTION);
+
+    if (fn->builtin == builtin_and ||
+        fn->builtin == builtin_or ||
+        fn->builtin == builtin_cond) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+#define MAX_BORROWED_ARGS 3
+
+// the indexing functions only read their arguments, so the values
+// of the symbols passed to them are borrowed from the environment
+// instead of copied (e.g., nth on a long list is O(1)); that is,
+// unless another argument is an s-expr, which could rebind them
+static int can_borrow_arguments(value* fn, value* v) {
+    if (fn->builtin != builtin_nth &&
+        fn->builtin != builtin_slice &&
+        fn->builtin != builtin_take &&
+        fn->builtin != builtin_drop &&
+        fn->builtin != builtin_len &&
+        fn->builtin != builtin_first) {
+        return 0;
+    }
+
+    if (v->num_children - 1 > MAX_BORROWED_ARGS) {
+        return 0;
+    }
+    for (size_t i = 1; i < v->num_children; i++) {
+        if (v->children[i]->type == VALUE_SEXPR) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+value* value_evaluate(value* v, environment* env) {
+    if (v->type == VALUE_SEXPR) {
+        char buffer[1024];
+        value* result = NULL;
+
+        value* temp = value_new_sexpr();
+        if (v->num_children == 0) {
+            return temp;
+        }
+
+        value* child = NULL;
         if (result == NULL) {
-            if (fn->builtin != NULL) {
-                result = fn->builtin(temp->children + 1, temp->num_children - 1, fn->symbol, env);
+            child = value_evaluate(v->children[0], env);
+            if (child->type == VALUE_ERROR) {
+                result = child;
             } else {
-                result = call_lambda(fn, temp->children + 1, temp->num_children - 1, env);
+                value_add_child(temp, child);
+            }
+        }
+
+        if (result == NULL) {
+            if (v->num_children == 1) {
+                result = temp->children[0];
+                temp->children[0] = NULL;  // don't dispose
+            }
+        }
+
+        value* fn = NULL;
+        if (result == NULL) {
+            fn = temp->children[0];
+            if (fn->type != VALUE_FUNCTION) {
+                value_to_str(v, buffer);
+                result = value_new_error("s-expr %s must start with a function", buffer);
+            }
+        }
+
+        int borrowing = (result == NULL && can_borrow_arguments(fn, v));
+        int borrowed[MAX_BORROWED_ARGS + 1] = {0};
+
+        if (result == NULL) {
+            for (size_t i = 1; i < v->num_children; i++) {
+                if (is_delayed_evaluation_function(fn)) {
+                    child = value_copy(v->children[i]);
+                } else if (borrowing && v->children[i]->type == VALUE_SYMBOL &&
+                           (child = environment_borrow(env, v->children[i]->symbol)) != NULL &&
+                           child->type != VALUE_ERROR) {
+                    borrowed[i] = 1;
+                } else {
+                    child = value_evaluate(v->children[i], env);
+                }
+
+                if (child->type == VALUE_ERROR) {
+                    result = child;
+                    break;
+                } else {
+                    value_add_child(temp, child);
+                }
             }
         }
 
+        if (result == NULL) {
+            result = value_apply(fn, temp->children + 1, temp->num_children - 1, env);
+        }
+
+        if (borrowing) {
+            for (size_t i = 1; i < temp->num_children; i++) {
+                if (borrowed[i]) {
+                    temp->children[i] = NULL;  // don't dispose
+                }
+            }
+        }
         value_dispose(temp);
 
         return result;
@@ -928,88 +2653,238 @@ value* value_evaluate(value* v, environment* env) {
     }
 }
 
-void environment_register_builtins(environment* e) {
-    // constants
-    environment_register_number(e, "E", 2.7182818);
-    environment_register_number(e, "PI", 3.1415926);
+typedef struct builtin {
+    char* name;
+    value_fn function;
+} builtin;
 
+// the builtins are shared by all environments: a name missing
+// from the global environment is looked up in this table
+static const builtin builtins[] = {
     // arithmetic builtins
-    environment_register_function(e, "+", builtin_add);
-    environment_register_function(e, "add", builtin_add);
-    environment_register_function(e, "-", builtin_subtract);
-    environment_register_function(e, "sub", builtin_subtract);
-    environment_register_function(e, "*", builtin_multiply);
-    environment_register_function(e, "mul", builtin_multiply);
-    environment_register_function(e, "/", builtin_divide);
-    environment_register_function(e, "div", builtin_divide);
-    environment_register_function(e, "%", builtin_modulo);
-    environment_register_function(e, "mod", builtin_modulo);
-    environment_register_function(e, "^", builtin_power);
-    environment_register_function(e, "pow", builtin_power);
-    environment_register_function(e, "min", builtin_minimum);
-    environment_register_function(e, "max", builtin_maximum);
+    {"+", builtin_add},
+    {"add", builtin_add},
+    {"-", builtin_subtract},
+    {"sub", builtin_subtract},
+    {"*", builtin_multiply},
+    {"mul", builtin_multiply},
+    {"/", builtin_divide},
+    {"div", builtin_divide},
+    {"%", builtin_modulo},
+    {"mod", builtin_modulo},
+    {"^", builtin_power},
+    {"pow", builtin_power},
+    {"min", builtin_minimum},
+    {"max", builtin_maximum},
 
     // list manipulation builtins
-    environment_register_function(e, "list", builtin_list);
-    environment_register_function(e, "first", builtin_first);
-    environment_register_function(e, "car", builtin_first);
-    environment_register_function(e, "head", builtin_head);
-    environment_register_function(e, "tail", builtin_tail);
-    environment_register_function(e, "cdr", builtin_tail);
-    environment_register_function(e, "join", builtin_join);
-    environment_register_function(e, "eval", builtin_eval);
-    environment_register_function(e, "cons", builtin_cons);
-    environment_register_function(e, "len", builtin_len);
-    environment_register_function(e, "init", builtin_init);
+    {"list", builtin_list},
+    {"first", builtin_first},
+    {"car", builtin_first},
+    {"head", builtin_head},
+    {"tail", builtin_tail},
+    {"cdr", builtin_tail},
+    {"join", builtin_join},
+    {"eval", builtin_eval},
+    {"cons", builtin_cons},
+    {"len", builtin_len},
+    {"init", builtin_init},
+    {"nth", builtin_nth},
+    {"slice", builtin_slice},
+    {"take", builtin_take},
+    {"drop", builtin_drop},
 
     // definition builtins
-    environment_register_function(e, "def", builtin_def);
-    environment_register_function(e, "local", builtin_local);
-    environment_register_function(e, "=", builtin_local);
-    environment_register_function(e, "lambda", builtin_lambda);
-    environment_register_function(e, "fn", builtin_fn);
-    environment_register_function(e, "del", builtin_del);
+    {"def", builtin_def},
+    {"local", builtin_local},
+    {"=", builtin_local},
+    {"lambda", builtin_lambda},
+    {"fn", builtin_fn},
+    {"del", builtin_del},
 
     // comparison functions
-    environment_register_function(e, "==", builtin_eq);
-    environment_register_function(e, "eq", builtin_eq);
-    environment_register_function(e, "!=", builtin_neq);
-    environment_register_function(e, "neq", builtin_neq);
-    environment_register_function(e, ">", builtin_gt);
-    environment_register_function(e, "gt", builtin_gt);
-    environment_register_function(e, ">=", builtin_gte);
-    environment_register_function(e, "gte", builtin_gte);
-    environment_register_function(e, "<", builtin_lt);
-    environment_register_function(e, "lt", builtin_lt);
-    environment_register_function(e, "<=", builtin_lte);
-    environment_register_function(e, "lte", builtin_lte);
-    environment_register_function(e, "null?", builtin_null_q);
-    environment_register_function(e, "empty?", builtin_null_q);
-    environment_register_function(e, "zero?", builtin_zero_q);
-    environment_register_function(e, "list?", builtin_list_q);
+    {"==", builtin_eq},
+    {"eq", builtin_eq},
+    {"!=", builtin_neq},
+    {"neq", builtin_neq},
+    {">", builtin_gt},
+    {"gt", builtin_gt},
+    {">=", builtin_gte},
+    {"gte", builtin_gte},
+    {"<", builtin_lt},
+    {"lt", builtin_lt},
+    {"<=", builtin_lte},
+    {"lte", builtin_lte},
+    {"null?", builtin_null_q},
+    {"empty?", builtin_null_q},
+    {"zero?", builtin_zero_q},
+    {"list?", builtin_list_q},
 
     // conditional functions
-    environment_register_function(e, "if", builtin_if);
-    environment_register_function(e, "cond", builtin_cond);
-    environment_register_function(e, "switch", builtin_cond);
+    {"if", builtin_if},
+    {"cond", builtin_cond},
+    {"switch", builtin_cond},
 
     // logical functions
-    environment_register_function(e, "&&", builtin_and);
-    environment_register_function(e, "and", builtin_and);
-    environment_register_function(e, "||", builtin_or);
-    environment_register_function(e, "or", builtin_or);
-    environment_register_function(e, "!", builtin_not);
-    environment_register_function(e, "not", builtin_not);
+    {"&&", builtin_and},
+    {"and", builtin_and},
+    {"||", builtin_or},
+    {"or", builtin_or},
+    {"!", builtin_not},
+    {"not", builtin_not},
 
     // string functions
-    environment_register_function(e, "seval", builtin_seval);
-    environment_register_function(e, "load", builtin_load);
-    environment_register_function(e, "print", builtin_print);
-    environment_register_function(e, "error", builtin_error);
-    environment_register_function(e, "info", builtin_info);
-    environment_register_function(e, "sjoin", builtin_sjoin);
-    environment_register_function(e, "shead", builtin_shead);
-    environment_register_function(e, "stail", builtin_stail);
-    environment_register_function(e, "sinit", builtin_sinit);
-    environment_register_function(e, "slen", builtin_slen);
+    {"seval", builtin_seval},
+    {"load", builtin_load},
+    {"dump", builtin_dump},
+    {"print", builtin_print},
+    {"error", builtin_error},
+    {"info", builtin_info},
+    {"sjoin", builtin_sjoin},
+    {"shead", builtin_shead},
+    {"stail", builtin_stail},
+    {"sinit", builtin_sinit},
+    {"slen", builtin_slen},
+
+    // file functions
+    {"fopen", builtin_fopen},
+    {"fclose", builtin_fclose},
+    {"freadline", builtin_freadline},
+    {"fread", builtin_fread},
+    {"fwrite", builtin_fwrite},
+    {"fflush", builtin_fflush},
+    {"feach", builtin_feach},
+
+    // higher-order functions
+    {"map", builtin_map},
+    {"filter", builtin_filter},
+    {"foldl", builtin_foldl},
+    {"foldr", builtin_foldr},
+    {"sort", builtin_sort},
+    {"stable-sort", builtin_stable_sort},
+
+    // parallel functions
+    {"pmap", builtin_pmap},
+    {"preduce", builtin_preduce},
+    {"future", builtin_future},
+    {"await", builtin_await},
+    {"spawn", builtin_spawn},
+    {"sync", builtin_sync},
+
+    // channel functions
+    {"chan", builtin_chan},
+    {"send", builtin_send},
+    {"receive", builtin_receive},
+    {"close", builtin_close},
+    {"select", builtin_select},
+
+    // array functions
+    {"array", builtin_array},
+    {"arange", builtin_arange},
+    {"vlist", builtin_vlist},
+    {"vslice", builtin_vslice},
+    {"v+", builtin_vadd},
+    {"v-", builtin_vsubtract},
+    {"v*", builtin_vmultiply},
+    {"v/", builtin_vdivide},
+    {"vsum", builtin_vsum},
+    {"vdot", builtin_vdot},
+    {"vmin", builtin_vmin},
+    {"vmax", builtin_vmax},
+
+    // hash map functions
+    {"hmap", builtin_hmap},
+    {"hget", builtin_hget},
+    {"hput", builtin_hput},
+    {"hdel", builtin_hdel},
+    {"hhas", builtin_hhas},
+    {"hitems", builtin_hitems},
+    {"hkeys", builtin_hkeys},
+    {"hvals", builtin_hvals},
+};
+
+#define NUM_BUILTINS (sizeof(builtins) / sizeof(builtin))
+#define BUILTIN_SLOTS 1024
+#define BUILTIN_MAX_SEEDS 65536
+
+// the slots hold builtin indices + 1 (0 for empty) at the positions
+// of a perfect hash of the names, seeded to avoid any collisions
+_Static_assert(NUM_BUILTINS < 255, "the builtin slots can't hold more than 254 builtins");
+static uint8_t builtin_slots[BUILTIN_SLOTS];
+static uint32_t builtin_seed = 0;
+static pthread_once_t builtin_once = PTHREAD_ONCE_INIT;
+
+static uint32_t hash_builtin_name(char* name, uint32_t seed) {
+    // FNV-1a
+    uint32_t hash = 2166136261u ^ seed;
+    for (; *name != '\0'; name++) {
+        hash ^= (uint8_t)*name;
+        hash *= 16777619u;
+    }
+
+    // the low bits of FNV-1a only depend on the low bits of the
+    // seed (there would be just BUILTIN_SLOTS seeds to try), so
+    // the high bits are folded in
+    return (hash ^ (hash >> 16)) & (BUILTIN_SLOTS - 1);
+}
+
+// with n names in m slots, a seed is collision-free with the
+// odds of e^(-n^2 / 2m): about 1 in 800 for 115 names in
+// 1024 slots, so the search ends within a few thousand seeds,
+// and a table outgrowing the slots fails loudly instead of hanging
+static void init_builtin_slots() {
+    for (uint32_t seed = 0; seed < BUILTIN_MAX_SEEDS; seed++) {
+        memset(builtin_slots, 0, sizeof(builtin_slots));
+
+        size_t i = 0;
+        for (; i < NUM_BUILTINS; i++) {
+            uint32_t slot = hash_builtin_name(builtins[i].name, seed);
+            if (builtin_slots[slot] != 0) {
+                break;
+            }
+            builtin_slots[slot] = i + 1;
+        }
+
+        if (i == NUM_BUILTINS) {
+            builtin_seed = seed;
+            return;
+        }
+    }
+
+    fprintf(
+        stderr,
+        "no perfect hash of the %zu builtins in %d slots with %d seeds\n",
+        NUM_BUILTINS, BUILTIN_SLOTS, BUILTIN_MAX_SEEDS);
+    abort();
+}
+
+value_fn get_builtin(char* name) {
+    pthread_once(&builtin_once, init_builtin_slots);
+
+    uint8_t index = builtin_slots[hash_builtin_name(name, builtin_seed)];
+    if (index != 0 && strcmp(builtins[index - 1].name, name) == 0) {
+        return builtins[index - 1].function;
+    }
+
+    return NULL;
+}
+
+char* get_builtin_name(value_fn function) {
+    for (size_t i = 0; i < NUM_BUILTINS; i++) {
+        if (builtins[i].function == function) {
+            return builtins[i].name;
+        }
+    }
+
+    return NULL;
+}
+
+char* get_builtin_name_at(size_t index) {
+    return index < NUM_BUILTINS ? builtins[index].name : NULL;
+}
+
+void environment_register_builtins(environment* e) {
+    // constants
+    environment_register_number(e, "E", 2.7182818);
+    environment_register_number(e, "PI", 3.1415926);
 }
@@ -5,7 +5,12 @@
 #include "value.h"
 
 value* value_evaluate(value* t, environment* env);
+value* value_apply(value* fn, value** args, size_t num_args, environment* env);
 
 void environment_register_builtins(environment* e);
 
+char* get_builtin_name(value_fn builtin);
+char* get_builtin_name_at(size_t index);  // NULL past the last one
+value_fn get_builtin(char* name);
+
 #endif  // EVAL_H_
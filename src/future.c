@@ -0,0 +1,192 @@
+#include "future.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "env.h"
+#include "eval.h"
+#include "pool.h"
+#include "value.h"
+
+typedef enum {
+    FUTURE_PENDING = 0,
+    FUTURE_RUNNING = 1,
+    FUTURE_DONE = 2
+} future_state;
+
+// a future is run once, either by a worker of the pool or
+// by the first await if no worker has picked it up by then
+struct value_future {
+    value* expr;
+    environment* env;
+    value* result;
+    future_state state;
+    size_t num_refs;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+};
+
+static int future_claim(value_future* f) {
+    pthread_mutex_lock(&f->mutex);
+    int claimed = (f->state == FUTURE_PENDING);
+    if (claimed) {
+        f->state = FUTURE_RUNNING;
+    }
+    pthread_mutex_unlock(&f->mutex);
+
+    return claimed;
+}
+
+static void future_run(value_future* f) {
+    value* temp = value_copy(f->expr);
+    temp->type = VALUE_SEXPR;
+    value* result = value_evaluate(temp, f->env);
+    value_dispose(temp);
+
+    // the snapshot isn't needed anymore
+    value_dispose(f->expr);
+    environment_dispose(f->env);
+    free(f->env);
+    f->expr = NULL;
+    f->env = NULL;
+
+    pthread_mutex_lock(&f->mutex);
+    f->result = result;
+    f->state = FUTURE_DONE;
+    pthread_cond_broadcast(&f->done);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+static void run_future_task(void* arg, size_t index) {
+    value_future* f = arg;
+    if (future_claim(f)) {
+        future_run(f);
+    }
+    future_release(f);
+}
+
+static value_future* future_new(value* expr, environment* env) {
+    value_future* f = malloc(sizeof(value_future));
+
+    // the expression is evaluated in a snapshot of the bindings,
+    // for it not to race with the caller: the snapshot shares the
+    // bound values, so a future costs the same however large they are
+    f->expr = value_copy(expr);
+    f->env = malloc(sizeof(environment));
+    environment_snapshot(f->env, env);
+    f->result = NULL;
+    f->state = FUTURE_PENDING;
+    f->num_refs = 1;
+    pthread_mutex_init(&f->mutex, NULL);
+    pthread_cond_init(&f->done, NULL);
+
+    return f;
+}
+
+value* future_start(value* expr, environment* env) {
+    value_future* f = future_new(expr, env);
+
+    // the task holds a reference of its own
+    future_retain(f);
+    if (!pool_submit(run_future_task, f)) {
+        future_release(f);
+    }
+
+    return value_new_future(f);
+}
+
+value* future_spawn(value* expr, environment* env) {
+    if (!pool_should_spawn()) {
+        // past the cutoff, the expression is evaluated right away
+        // in the bindings of the caller, sparing the snapshot
+        value* temp = value_copy(expr);
+        temp->type = VALUE_SEXPR;
+        value* result = value_evaluate(temp, env);
+        value_dispose(temp);
+
+        value_future* f = malloc(sizeof(value_future));
+        f->expr = NULL;
+        f->env = NULL;
+        f->result = result;
+        f->state = FUTURE_DONE;
+        f->num_refs = 1;
+        pthread_mutex_init(&f->mutex, NULL);
+        pthread_cond_init(&f->done, NULL);
+
+        return value_new_future(f);
+    }
+
+    value_future* f = future_new(expr, env);
+
+    // the task holds a reference of its own
+    future_retain(f);
+    if (!pool_spawn(run_future_task, f)) {
+        future_release(f);
+    }
+
+    return value_new_future(f);
+}
+
+value* future_await(value_future* f) {
+    if (future_claim(f)) {
+        future_run(f);
+    }
+
+    pthread_mutex_lock(&f->mutex);
+    while (f->state != FUTURE_DONE) {
+        pthread_cond_wait(&f->done, &f->mutex);
+    }
+    pthread_mutex_unlock(&f->mutex);
+
+    return value_copy(f->result);
+}
+
+value* future_sync(value_future* f) {
+    // the waiting thread runs other tasks in the meantime, starting
+    // with its own latest ones, which the future is likely among
+    while (!future_is_done(f)) {
+        if (pool_help()) {
+            continue;
+        }
+
+        if (future_claim(f)) {
+            future_run(f);
+            break;
+        }
+
+        pthread_mutex_lock(&f->mutex);
+        while (f->state != FUTURE_DONE) {
+            pthread_cond_wait(&f->done, &f->mutex);
+        }
+        pthread_mutex_unlock(&f->mutex);
+    }
+
+    return value_copy(f->result);
+}
+
+int future_is_done(value_future* f) {
+    pthread_mutex_lock(&f->mutex);
+    int done = (f->state == FUTURE_DONE);
+    pthread_mutex_unlock(&f->mutex);
+
+    return done;
+}
+
+void future_retain(value_future* f) {
+    __sync_fetch_and_add(&f->num_refs, 1);
+}
+
+void future_release(value_future* f) {
+    if (__sync_sub_and_fetch(&f->num_refs, 1) == 0) {
+        if (f->state == FUTURE_PENDING) {
+            value_dispose(f->expr);
+            environment_dispose(f->env);
+            free(f->env);
+        } else {
+            value_dispose(f->result);
+        }
+        pthread_mutex_destroy(&f->mutex);
+        pthread_cond_destroy(&f->done);
+        free(f);
+    }
+}
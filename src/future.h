@@ -0,0 +1,16 @@
+#ifndef FUTURE_H_
+#define FUTURE_H_
+
+#include "env.h"
+#include "value.h"
+
+value* future_start(value* expr, environment* env);
+value* future_spawn(value* expr, environment* env);
+value* future_await(value_future* f);
+value* future_sync(value_future* f);
+int future_is_done(value_future* f);
+
+void future_retain(value_future* f);
+void future_release(value_future* f);
+
+#endif  // FUTURE_H_
@@ -0,0 +1,172 @@
+#include "image.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "eval.h"
+#include "serialize.h"
+#include "value.h"
+
+#define IMAGE_MAGIC "mylispi"
+#define IMAGE_VERSION 3
+
+// the image file starts with this header, followed by the
+// bindings of the global environment: each one is a serialized
+// symbol (the name) and a byte telling if the serialized value
+// follows (it doesn't for the deleted builtins)
+typedef struct image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_bindings;
+} image_header;
+
+static int write_bindings(environment* env, FILE* file) {
+    for (size_t i = 0; i < env->length; i++) {
+        value* name = value_new_symbol(env->bindings[i]->name);
+        uint8_t bound = (env->bindings[i]->value != NULL);
+        int written = value_serialize(name, file) &&
+                      fwrite(&bound, sizeof(bound), 1, file) == 1 &&
+                      (!bound || value_serialize(env->bindings[i]->value, file));
+        value_dispose(name);
+
+        if (!written) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int image_dump(environment* env, char* path) {
+    while (env->parent != NULL) {
+        env = env->parent;
+    }
+
+    image_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.num_bindings = env->length;
+
+    char* temp_path = malloc(strlen(path) + 8);
+    sprintf(temp_path, "%s.XXXXXX", path);
+
+    // the image is written aside and renamed when complete,
+    // so an interrupted dump never replaces a good image
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        free(temp_path);
+        return 0;
+    }
+
+    fchmod(fd, 0644);
+    FILE* file = fdopen(fd, "wb");
+    if (file == NULL) {
+        close(fd);
+        remove(temp_path);
+        free(temp_path);
+        return 0;
+    }
+
+    int result = fwrite(&header, sizeof(header), 1, file) == 1 && write_bindings(env, file);
+    result = (fclose(file) == 0) && result;
+    result = result && rename(temp_path, path) == 0;
+    if (!result) {
+        remove(temp_path);
+    }
+    free(temp_path);
+
+    return result;
+}
+
+static int read_bindings(environment* env, char* running, char* limit, size_t num_bindings) {
+    for (size_t i = 0; i < num_bindings; i++) {
+        value* name = value_deserialize(&running, limit);
+        if (name == NULL || name->type != VALUE_SYMBOL) {
+            if (name != NULL) {
+                value_dispose(name);
+            }
+            return 0;
+        }
+
+        if (running == limit || (*running != 0 && *running != 1)) {
+            value_dispose(name);
+            return 0;
+        }
+
+        value* v = NULL;
+        if (*running++ == 1) {
+            v = value_deserialize(&running, limit);
+            if (v == NULL) {
+                value_dispose(name);
+                return 0;
+            }
+        }
+
+        environment_append(env, name->symbol, v);
+        value_dispose(name);
+    }
+
+    return running == limit;
+}
+
+int image_restore(environment* env, char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(image_header)) {
+        close(fd);
+        return 0;
+    }
+
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    image_header header;
+    memcpy(&header, data, sizeof(header));
+
+    int result = 0;
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == IMAGE_VERSION) {
+        posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+        result = read_bindings(
+            env, data + sizeof(header), data + st.st_size,
+            header.num_bindings);
+    }
+
+    munmap(data, st.st_size);
+
+    return result;
+}
+
+int image_init_environment(environment* env, char* path) {
+    environment_init(env);
+
+    if (path == NULL) {
+        environment_register_builtins(env);
+        return 1;
+    }
+
+    // a partially restored environment is discarded
+    if (!image_restore(env, path)) {
+        environment_dispose(env);
+        environment_init(env);
+        return 0;
+    }
+
+    return 1;
+}
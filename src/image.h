@@ -0,0 +1,11 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include "env.h"
+
+int image_dump(environment* env, char* path);
+int image_restore(environment* env, char* path);
+
+int image_init_environment(environment* env, char* path);
+
+#endif  // IMAGE_H_
@@ -1,13 +1,71 @@
+#include <stdio.h>
 #include <string.h>
 
 #include "repl.h"
+#include "script.h"
+#include "server.h"
 #include "test.h"
 
+static int print_usage(char* program) {
+    fprintf(stderr,
+            "usage: %s [-i <image>]                      start the repl\n"
+            "       %s test [-j <jobs>] [-b <ms>]        run the tests\n"
+            "       %s [-i <image>] run <file> [args]    run a script ('-' for stdin)\n"
+            "       %s [-i <image>] -e <expr> [args]     evaluate an expression\n"
+            "       %s [-i <image>] -n <expr> [args]     evaluate an expression per line of stdin\n"
+            "       %s [-i <image>] serve <socket> [files]    serve evaluation requests\n"
+            "       %s client <socket> [exprs]           send requests (stdin if none)\n",
+            program, program, program, program, program, program, program);
+
+    return 2;
+}
+
 int main(int argc, char** argv) {
-    if (argc > 1 && strcmp(argv[1], "test") == 0) {
-        run_test();
+    char* program = argv[0];
+
+    // the global environment is restored
+    // from the image instead of the builtins
+    char* image = NULL;
+    if (argc > 1 && strcmp(argv[1], "-i") == 0) {
+        if (argc < 3) {
+            return print_usage(program);
+        }
+        image = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "test") == 0 && image == NULL) {
+        return run_test(argc - 2, argv + 2);
+    } else if (argc > 1 && strcmp(argv[1], "run") == 0) {
+        if (argc < 3) {
+            return print_usage(program);
+        }
+        return run_script(get_std_streams(), image, argv[2], argc - 3, argv + 3);
+    } else if (argc > 1 && strcmp(argv[1], "-e") == 0) {
+        if (argc < 3) {
+            return print_usage(program);
+        }
+        return run_expression(get_std_streams(), image, argv[2], argc - 3, argv + 3);
+    } else if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+        if (argc < 3) {
+            return print_usage(program);
+        }
+        return run_lines(get_std_streams(), image, argv[2], argc - 3, argv + 3);
+    } else if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        if (argc < 3) {
+            return print_usage(program);
+        }
+        return run_server(image, argv[2], argc - 3, argv + 3);
+    } else if (argc > 1 && strcmp(argv[1], "client") == 0 && image == NULL) {
+        if (argc < 3) {
+            return print_usage(program);
+        }
+        return run_client(argv[2], argc - 3, argv + 3);
+    } else if (argc > 1) {
+        return print_usage(program);
     } else {
-        run_repl();
+        return run_repl(image);
     }
 
     return 0;
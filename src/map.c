@@ -0,0 +1,394 @@
+#include "map.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "value.h"
+
+#define MAP_MIN_CAPACITY 8
+
+// the longer maps are printed with the first entries only
+#define MAP_PRINT_LIMIT 16
+
+#define SLOT_EMPTY 0
+#define SLOT_DELETED SIZE_MAX
+
+// the entries are kept in the order of insertion (the deleted
+// ones have no key until the next resize compacts them), and
+// the slots of an open-addressing table with linear probing
+// hold the indices of the entries + 1, so the iteration order
+// doesn't depend on the hashes
+typedef struct map_entry {
+    uint64_t hash;
+    value* key;
+    value* value;
+} map_entry;
+
+// the functions of a map lock its mutex, and the values are
+// copied in and out, so no thread holds on to the entries
+struct value_map {
+    map_entry* entries;
+    size_t num_entries;
+    size_t length;
+    size_t* slots;
+    size_t capacity;
+    size_t num_refs;
+    pthread_mutex_t mutex;
+};
+
+static uint64_t mix_hash(uint64_t hash) {
+    // the finalizer of splitmix64
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+
+    return hash;
+}
+
+// the keys are hashed by their contents, consistently with
+// value_equals: an integer and a double of the same value
+// (e.g., 2 and 2.0) are hashed alike
+static uint64_t hash_value(value* v) {
+    uint64_t hash;
+    double number;
+
+    switch (v->type) {
+        case VALUE_NUMBER:
+        case VALUE_INTEGER:
+            number = (v->number == 0) ? 0 : v->number;  // -0 == 0
+            memcpy(&hash, &number, sizeof(hash));
+            return mix_hash(hash);
+        case VALUE_BOOL:
+            return mix_hash(VALUE_BOOL + (uint64_t)v->number);
+        case VALUE_SYMBOL:
+        case VALUE_STRING:
+            // FNV-1a
+            hash = 14695981039346656037ULL ^ v->type;
+            for (char* c = v->symbol; *c != '\0'; c++) {
+                hash ^= (uint8_t)*c;
+                hash *= 1099511628211ULL;
+            }
+            return mix_hash(hash);
+        case VALUE_QEXPR:
+            hash = VALUE_QEXPR;
+            for (size_t i = 0; i < v->num_children; i++) {
+                hash = mix_hash(hash ^ hash_value(v->children[i]));
+            }
+            return hash;
+        default:
+            return 0;
+    }
+}
+
+int map_is_hashable(value* key) {
+    switch (key->type) {
+        case VALUE_NUMBER:
+        case VALUE_INTEGER:
+        case VALUE_BOOL:
+        case VALUE_SYMBOL:
+        case VALUE_STRING:
+            return 1;
+        case VALUE_QEXPR:
+            for (size_t i = 0; i < key->num_children; i++) {
+                if (!map_is_hashable(key->children[i])) {
+                    return 0;
+                }
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// the same as value_equals on the hashable values, without allocating
+static int keys_equal(value* k1, value* k2) {
+    if (value_is_number(k1) && value_is_number(k2)) {
+        return value_numbers_equal(k1, k2);
+    } else if (k1->type != k2->type) {
+        return 0;
+    }
+
+    switch (k1->type) {
+        case VALUE_BOOL:
+            return k1->number == k2->number;
+        case VALUE_SYMBOL:
+        case VALUE_STRING:
+            return strcmp(k1->symbol, k2->symbol) == 0;
+        case VALUE_QEXPR:
+            if (k1->num_children != k2->num_children) {
+                return 0;
+            }
+            for (size_t i = 0; i < k1->num_children; i++) {
+                if (!keys_equal(k1->children[i], k2->children[i])) {
+                    return 0;
+                }
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// returns the slot holding the key, or the empty slot ending its probe
+static size_t* find_slot(value_map* m, value* key, uint64_t hash) {
+    size_t mask = m->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        size_t slot = m->slots[i];
+        if (slot == SLOT_EMPTY) {
+            return &m->slots[i];
+        } else if (slot != SLOT_DELETED) {
+            map_entry* entry = &m->entries[slot - 1];
+            if (entry->hash == hash && keys_equal(entry->key, key)) {
+                return &m->slots[i];
+            }
+        }
+    }
+}
+
+// the tables are resized when the entries (live or deleted) take
+// 3/4 of the slots, to keep at most half of them taken afterwards
+static void resize(value_map* m) {
+    size_t capacity = MAP_MIN_CAPACITY;
+    while (capacity < 2 * (m->length + 1)) {
+        capacity *= 2;
+    }
+
+    size_t num_entries = 0;
+    for (size_t i = 0; i < m->num_entries; i++) {
+        if (m->entries[i].key != NULL) {
+            m->entries[num_entries++] = m->entries[i];
+        }
+    }
+    m->num_entries = num_entries;
+    m->entries = realloc(m->entries, (capacity / 4 * 3) * sizeof(map_entry));
+
+    m->capacity = capacity;
+    free(m->slots);
+    m->slots = calloc(capacity, sizeof(size_t));
+    for (size_t i = 0; i < num_entries; i++) {
+        size_t mask = capacity - 1;
+        size_t j = m->entries[i].hash & mask;
+        while (m->slots[j] != SLOT_EMPTY) {
+            j = (j + 1) & mask;
+        }
+        m->slots[j] = i + 1;
+    }
+}
+
+value* map_new() {
+    value_map* m = malloc(sizeof(value_map));
+
+    m->entries = NULL;
+    m->num_entries = 0;
+    m->length = 0;
+    m->slots = NULL;
+    m->num_refs = 1;
+    pthread_mutex_init(&m->mutex, NULL);
+    resize(m);
+
+    return value_new_map(m);
+}
+
+value* map_get(value_map* m, value* key) {
+    value* result = NULL;
+
+    pthread_mutex_lock(&m->mutex);
+    size_t slot = *find_slot(m, key, hash_value(key));
+    if (slot != SLOT_EMPTY) {
+        result = value_copy(m->entries[slot - 1].value);
+    }
+    pthread_mutex_unlock(&m->mutex);
+
+    return result;
+}
+
+// the map takes the key and the value
+void map_put(value_map* m, value* key, value* v) {
+    uint64_t hash = hash_value(key);
+
+    pthread_mutex_lock(&m->mutex);
+    size_t* slot = find_slot(m, key, hash);
+    if (*slot != SLOT_EMPTY) {
+        map_entry* entry = &m->entries[*slot - 1];
+        value_dispose(entry->value);
+        value_dispose(key);
+        entry->value = v;
+    } else {
+        if (m->num_entries == m->capacity / 4 * 3) {
+            resize(m);
+            slot = find_slot(m, key, hash);
+        }
+
+        map_entry* entry = &m->entries[m->num_entries++];
+        entry->hash = hash;
+        entry->key = key;
+        entry->value = v;
+        *slot = m->num_entries;
+        m->length++;
+    }
+    pthread_mutex_unlock(&m->mutex);
+}
+
+int map_delete(value_map* m, value* key) {
+    int deleted = 0;
+
+    pthread_mutex_lock(&m->mutex);
+    size_t* slot = find_slot(m, key, hash_value(key));
+    if (*slot != SLOT_EMPTY) {
+        map_entry* entry = &m->entries[*slot - 1];
+        value_dispose(entry->key);
+        value_dispose(entry->value);
+        entry->key = NULL;
+        entry->value = NULL;
+        *slot = SLOT_DELETED;
+        m->length--;
+        deleted = 1;
+    }
+    pthread_mutex_unlock(&m->mutex);
+
+    return deleted;
+}
+
+size_t map_length(value_map* m) {
+    pthread_mutex_lock(&m->mutex);
+    size_t length = m->length;
+    pthread_mutex_unlock(&m->mutex);
+
+    return length;
+}
+
+// a snapshot of the entries as a q-expr of {key value} pairs
+static value* get_items(value_map* m, size_t limit) {
+    value* result = value_new_qexpr();
+
+    pthread_mutex_lock(&m->mutex);
+    for (size_t i = 0; i < m->num_entries && result->num_children < limit; i++) {
+        if (m->entries[i].key != NULL) {
+            value* item = value_new_qexpr();
+            value_add_child(item, value_copy(m->entries[i].key));
+            value_add_child(item, value_copy(m->entries[i].value));
+            value_add_child(result, item);
+        }
+    }
+    pthread_mutex_unlock(&m->mutex);
+
+    return result;
+}
+
+value* map_items(value_map* m) {
+    return get_items(m, SIZE_MAX);
+}
+
+// the entries are printed from a snapshot, so printing
+// a map doesn't hold its lock (nor those of the maps in it)
+int map_to_str(value_map* m, char* buffer) {
+    char* running = buffer;
+    value* items = get_items(m, MAP_PRINT_LIMIT);
+
+    running += sprintf(running, "<map");
+    for (size_t i = 0; i < items->num_children; i++) {
+        *running++ = ' ';
+        running += value_to_str(items->children[i], running);
+    }
+    if (map_length(m) > items->num_children) {
+        running += sprintf(running, " ...");
+    }
+    running += sprintf(running, ">");
+    value_dispose(items);
+
+    return running - buffer;
+}
+
+void map_print(value_map* m, FILE* stream) {
+    value* items = get_items(m, MAP_PRINT_LIMIT);
+
+    fputs("<map", stream);
+    for (size_t i = 0; i < items->num_children; i++) {
+        fputc(' ', stream);
+        value_print(items->children[i], stream);
+    }
+    if (map_length(m) > items->num_children) {
+        fputs(" ...", stream);
+    }
+    fputc('>', stream);
+    value_dispose(items);
+}
+
+// the maps are equal when they have equal values under the same
+// keys (in any order), and they're compared one lock at a time
+int map_equals(value_map* m1, value_map* m2) {
+    if (m1 == m2) {
+        return 1;
+    }
+
+    value* items = map_items(m1);
+    int equal = (items->num_children == map_length(m2));
+    for (size_t i = 0; equal && i < items->num_children; i++) {
+        value* v2 = map_get(m2, items->children[i]->children[0]);
+        if (v2 == NULL) {
+            equal = 0;
+        } else {
+            value* result = value_equals(items->children[i]->children[1], v2);
+            equal = (result->type == VALUE_BOOL && result->number == 1);
+            value_dispose(result);
+            value_dispose(v2);
+        }
+    }
+    value_dispose(items);
+
+    return equal;
+}
+
+// tells if the map can be reached from the value, through the
+// q-exprs, the lambdas and the other maps: a map put in itself
+// would be printed and compared forever, and never be released;
+// the maps are walked from snapshots, one lock at a time
+int map_is_reachable(value_map* m, value* v) {
+    int reachable = 0;
+    value* items;
+
+    switch (v->type) {
+        case VALUE_MAP:
+            if (v->map == m) {
+                return 1;
+            }
+            items = map_items(v->map);
+            reachable = map_is_reachable(m, items);
+            value_dispose(items);
+            return reachable;
+        case VALUE_FUNCTION:
+            return v->builtin == NULL && (map_is_reachable(m, v->args) || map_is_reachable(m, v->body));
+        case VALUE_SEXPR:
+        case VALUE_QEXPR:
+            for (size_t i = 0; i < v->num_children && !reachable; i++) {
+                reachable = map_is_reachable(m, v->children[i]);
+            }
+            return reachable;
+        default:
+            return 0;
+    }
+}
+
+void map_retain(value_map* m) {
+    __sync_fetch_and_add(&m->num_refs, 1);
+}
+
+void map_release(value_map* m) {
+    if (__sync_sub_and_fetch(&m->num_refs, 1) == 0) {
+        for (size_t i = 0; i < m->num_entries; i++) {
+            if (m->entries[i].key != NULL) {
+                value_dispose(m->entries[i].key);
+                value_dispose(m->entries[i].value);
+            }
+        }
+        free(m->entries);
+        free(m->slots);
+        pthread_mutex_destroy(&m->mutex);
+        free(m);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef MAP_H_
+#define MAP_H_
+
+#include <stdio.h>
+
+#include "value.h"
+
+value* map_new();
+int map_is_hashable(value* key);
+value* map_get(value_map* m, value* key);
+void map_put(value_map* m, value* key, value* v);
+int map_delete(value_map* m, value* key);
+size_t map_length(value_map* m);
+value* map_items(value_map* m);
+
+int map_to_str(value_map* m, char* buffer);
+void map_print(value_map* m, FILE* stream);
+int map_equals(value_map* m1, value_map* m2);
+int map_is_reachable(value_map* m, value* v);
+
+void map_retain(value_map* m);
+void map_release(value_map* m);
+
+#endif  // MAP_H_
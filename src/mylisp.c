@@ -0,0 +1,141 @@
+#include "mylisp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "env.h"
+#include "eval.h"
+#include "parse.h"
+#include "value.h"
+
+struct mylisp {
+    // the global environment comes first for
+    // the interpreter to be found from it
+    environment env;
+};
+
+mylisp* mylisp_create(void) {
+    mylisp* m = malloc(sizeof(mylisp));
+
+    environment_init(&m->env);
+    environment_register_builtins(&m->env);
+
+    return m;
+}
+
+void mylisp_destroy(mylisp* m) {
+    environment_dispose(&m->env);
+    free(m);
+}
+
+void mylisp_set_userdata(mylisp* m, void* userdata) {
+    m->env.context.userdata = userdata;
+}
+
+void* mylisp_get_userdata(mylisp* m) {
+    return m->env.context.userdata;
+}
+
+void mylisp_set_output(mylisp* m, FILE* output) {
+    m->env.context.output = output;
+}
+
+mylisp* mylisp_from_environment(environment* env) {
+    while (env->parent != NULL) {
+        env = env->parent;
+    }
+
+    return (mylisp*)env;
+}
+
+mylisp_value* mylisp_eval(mylisp* m, const char* source) {
+    value* v = mylisp_compile(source);
+    if (v->type != VALUE_ERROR) {
+        value* e = value_evaluate(v, &m->env);
+        value_dispose(v);
+        v = e;
+    }
+
+    return v;
+}
+
+mylisp_value* mylisp_compile(const char* source) {
+    return value_parse((char*)source);
+}
+
+mylisp_value* mylisp_eval_compiled(mylisp* m, mylisp_value* compiled) {
+    if (compiled->type == VALUE_ERROR) {
+        return value_copy(compiled);
+    }
+
+    return value_evaluate(compiled, &m->env);
+}
+
+mylisp_value* mylisp_call(mylisp* m, mylisp_value* fn, mylisp_value** args, size_t num_args) {
+    return value_apply(fn, args, num_args, &m->env);
+}
+
+mylisp_value* mylisp_get(mylisp* m, const char* name) {
+    return environment_get(&m->env, (char*)name);
+}
+
+void mylisp_set(mylisp* m, const char* name, mylisp_value* v) {
+    environment_put(&m->env, (char*)name, v, 0);
+}
+
+void mylisp_register(mylisp* m, const char* name, mylisp_callback callback) {
+    environment_register_function(&m->env, (char*)name, callback);
+}
+
+mylisp_value* mylisp_number(double number) {
+    return value_new_number(number);
+}
+
+mylisp_value* mylisp_string(const char* string) {
+    return value_new_string((char*)string);
+}
+
+mylisp_value* mylisp_error(const char* message) {
+    return value_new_error("%s", message);
+}
+
+void mylisp_release(mylisp_value* v) {
+    if (v != NULL) {
+        value_dispose(v);
+    }
+}
+
+int mylisp_is_error(mylisp_value* v) {
+    return v->type == VALUE_ERROR;
+}
+
+int mylisp_to_double(mylisp_value* v, double* result) {
+    if (!value_is_number(v) && v->type != VALUE_BOOL) {
+        return 0;
+    }
+    *result = v->number;
+
+    return 1;
+}
+
+const char* mylisp_to_string(mylisp_value* v) {
+    switch (v->type) {
+        case VALUE_SYMBOL:
+        case VALUE_ERROR:
+        case VALUE_INFO:
+        case VALUE_STRING:
+            return v->symbol;
+        default:
+            return NULL;
+    }
+}
+
+char* mylisp_print(mylisp_value* v) {
+    char* buffer = NULL;
+    size_t length = 0;
+    FILE* stream = open_memstream(&buffer, &length);
+    value_print(v, stream);
+    fclose(stream);
+
+    return buffer;
+}
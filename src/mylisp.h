@@ -0,0 +1,77 @@
+#ifndef MYLISP_H_
+#define MYLISP_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+// the embedding API of bin/mylisp.so
+//
+// ownership: every mylisp_value* returned by a function below
+// belongs to the caller and must be released with mylisp_release;
+// the values passed to a function are borrowed, unless noted.
+// an interpreter must not be used by several threads at a time,
+// but separate interpreters can run on separate threads.
+
+typedef struct mylisp mylisp;
+typedef struct value mylisp_value;
+typedef struct environment mylisp_environment;
+
+// native callbacks borrow their arguments and return a new value
+// (e.g., from mylisp_number); the name is the one they're called by
+typedef mylisp_value* (*mylisp_callback)(
+    mylisp_value** args, size_t num_args,
+    char* name, mylisp_environment* env);
+
+// interpreters
+
+mylisp* mylisp_create(void);
+void mylisp_destroy(mylisp* m);
+
+void mylisp_set_userdata(mylisp* m, void* userdata);
+void* mylisp_get_userdata(mylisp* m);
+
+// the stream print and load write to (stdout by default)
+void mylisp_set_output(mylisp* m, FILE* output);
+
+// the interpreter running a callback, from its environment
+mylisp* mylisp_from_environment(mylisp_environment* env);
+
+// evaluation
+
+// parses and evaluates the source, like a line in the repl
+mylisp_value* mylisp_eval(mylisp* m, const char* source);
+
+// parses the source once, for mylisp_eval_compiled to evaluate
+// any number of times (the result is an error if it doesn't parse)
+mylisp_value* mylisp_compile(const char* source);
+mylisp_value* mylisp_eval_compiled(mylisp* m, mylisp_value* compiled);
+
+// applies a function (e.g., from mylisp_get) to the arguments
+mylisp_value* mylisp_call(mylisp* m, mylisp_value* fn, mylisp_value** args, size_t num_args);
+
+// globals
+
+mylisp_value* mylisp_get(mylisp* m, const char* name);
+void mylisp_set(mylisp* m, const char* name, mylisp_value* v);
+void mylisp_register(mylisp* m, const char* name, mylisp_callback callback);
+
+// values
+
+mylisp_value* mylisp_number(double number);
+mylisp_value* mylisp_string(const char* string);
+mylisp_value* mylisp_error(const char* message);
+void mylisp_release(mylisp_value* v);
+
+int mylisp_is_error(mylisp_value* v);
+
+// returns 1 and sets the result for numbers and bools, 0 otherwise
+int mylisp_to_double(mylisp_value* v, double* result);
+
+// the text of strings, symbols, errors and infos (NULL otherwise),
+// valid as long as the value
+const char* mylisp_to_string(mylisp_value* v);
+
+// the printed form of any value, to be freed by the caller
+char* mylisp_print(mylisp_value* v);
+
+#endif  // MYLISP_H_
@@ -2,17 +2,21 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "str.h"
 #include "value.h"
 
 static const char* exp_chars = "eE";
 static const char* sign_chars = "+-";
-static const char* digit_chars = "0123456789";
 static const char* whitespace_chars = " \t\r\n\v";
 static const char* alpha_chars =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
@@ -37,49 +41,135 @@ static value* create_parsing_error(size_t offset, char* format, ...) {
     return error;
 }
 
-static int is_number(char* symbol) {
-    char* running = symbol;
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
+static value* value_read_number_slow(char* content, size_t length, size_t offset) {
+    char small[64];
+    char* number = (length < sizeof(small)) ? small : malloc(length + 1);
+    strncpy(number, content, length);
+    number[length] = '\0';
+
+    value* result = NULL;
+
+    errno = 0;
+    double parsed = strtod(number, NULL);
+    if (errno == 0) {
+        result = value_new_number(parsed);
+    } else {
+        result = create_parsing_error(offset, "malformed number: %s", number);
+    }
+
+    if (number != small) {
+        free(number);
+    }
+
+    return result;
+}
+
+// validates and converts a numeric literal in one pass over the token;
+// returns NULL if the token is not a number (i.e., it must be a symbol)
+static value* value_read_number(char* content, size_t length, size_t offset) {
+    char* running = content;
+    char* end = content + length;
+
+    int negative = 0;
+    if (running < end && strchr(sign_chars, *running)) {
+        negative = (*running == '-');
+        running++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
     int digit_seen = 0;
-    int exp_seen = 0;
-    int dot_seen = 0;
+    int truncated = 0;
+    int integral = 1;
 
-    while (*running != '\0') {
-        if (strchr(digit_chars, *running)) {
-            digit_seen = 1;
-        } else if (strchr(sign_chars, *running)) {
-            if (running != symbol && !strchr(exp_chars, *(running - 1))) {
-                return 0;
-            }
-        } else if (strchr(exp_chars, *running)) {
-            if (exp_seen || !digit_seen) {
-                return 0;
-            }
-            digit_seen = 0;
-            exp_seen = 1;
-        } else if (*running == '.') {
-            if (dot_seen || exp_seen) {
-                return 0;
-            }
-            dot_seen = 1;
+    while (running < end && *running >= '0' && *running <= '9') {
+        if (mantissa <= (UINT64_MAX - 9) / 10) {
+            mantissa = mantissa * 10 + (*running - '0');
         } else {
-            return 0;
+            truncated = 1;
+            exponent++;
         }
+        digit_seen = 1;
         running++;
     }
 
-    return digit_seen;
-}
+    if (running < end && *running == '.') {
+        integral = 0;
+        running++;
+        while (running < end && *running >= '0' && *running <= '9') {
+            if (mantissa <= (UINT64_MAX - 9) / 10) {
+                mantissa = mantissa * 10 + (*running - '0');
+                exponent--;
+            } else {
+                truncated = 1;
+            }
+            digit_seen = 1;
+            running++;
+        }
+    }
 
-static value* value_read_number(char* content, size_t offset) {
-    errno = 0;
-    double result = strtod(content, NULL);
+    if (!digit_seen) {
+        return NULL;
+    }
 
-    if (errno == 0) {
-        return value_new_number(result);
-    } else {
-        return create_parsing_error(offset, "malformed number: %s", content);
+    if (running < end && strchr(exp_chars, *running)) {
+        integral = 0;
+        running++;
+
+        int exp_negative = 0;
+        if (running < end && strchr(sign_chars, *running)) {
+            exp_negative = (*running == '-');
+            running++;
+        }
+
+        int exp_digit_seen = 0;
+        int exp_value = 0;
+        while (running < end && *running >= '0' && *running <= '9') {
+            if (exp_value < 100000) {
+                exp_value = exp_value * 10 + (*running - '0');
+            }
+            exp_digit_seen = 1;
+            running++;
+        }
+
+        if (!exp_digit_seen) {
+            return NULL;
+        }
+
+        exponent += exp_negative ? -exp_value : exp_value;
     }
+
+    if (running != end) {
+        return NULL;
+    }
+
+    // literals without a fraction or an exponent are integers,
+    // unless they are out of range (then they become doubles)
+    uint64_t max_integer = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    if (integral && !truncated && mantissa <= max_integer) {
+        return value_new_integer(negative ? (int64_t)(0 - mantissa) : (int64_t)mantissa);
+    }
+
+    // both the mantissa and the power of ten are exact doubles,
+    // so a single multiplication or division is correctly rounded
+    int max_exponent = sizeof(exact_powers_of_ten) / sizeof(double) - 1;
+    if (!truncated && mantissa <= ((uint64_t)1 << 53) &&
+        exponent >= -max_exponent && exponent <= max_exponent) {
+        double result = (double)mantissa;
+        if (exponent < 0) {
+            result /= exact_powers_of_ten[-exponent];
+        } else {
+            result *= exact_powers_of_ten[exponent];
+        }
+
+        return value_new_number(negative ? -result : result);
+    }
+
+    return value_read_number_slow(content, length, offset);
 }
 
 static value* value_read_special(char* content, size_t offset) {
@@ -119,31 +209,31 @@ static value* value_read_string(char* content, size_t offset) {
     return result;
 }
 
-static int value_parse_symbol(char* input, value** v, size_t offset) {
+static int value_parse_symbol(char* input, char* limit, value** v, size_t offset) {
     char* running = input;
-    while (*running != '\0' && strchr(symbol_chars, *running)) {
+    while (running < limit && *running != '\0' && strchr(symbol_chars, *running)) {
         running++;
     }
 
     size_t length = running - input;
-    char* symbol = malloc(length + 1);
-    strncpy(symbol, input, length);
-    symbol[length] = '\0';
+    *v = value_read_number(input, length, offset);
+
+    if (*v == NULL) {
+        char* symbol = malloc(length + 1);
+        strncpy(symbol, input, length);
+        symbol[length] = '\0';
 
-    if (is_number(symbol)) {
-        *v = value_read_number(symbol, offset);
-    } else {
         *v = value_new_symbol(symbol);
-    }
 
-    free(symbol);
+        free(symbol);
+    }
 
     return length;
 }
 
-static int value_parse_special(char* input, value** v, size_t offset) {
+static int value_parse_special(char* input, char* limit, value** v, size_t offset) {
     char* running = input + 1;
-    while (*running != '\0' && strchr(alpha_chars, *running)) {
+    while (running < limit && *running != '\0' && strchr(alpha_chars, *running)) {
         running++;
     }
 
@@ -159,10 +249,10 @@ static int value_parse_special(char* input, value** v, size_t offset) {
     return length;
 }
 
-static int value_parse_string(char* input, value** v, size_t offset) {
+static int value_parse_string(char* input, char* limit, value** v, size_t offset) {
     char* running = input + 1;
-    while (!(*running == '\"' && *(running - 1) != '\\')) {
-        if (*running == '\0') {
+    while (running == limit || !(*running == '\"' && *(running - 1) != '\\')) {
+        if (running == limit || *running == '\0') {
             *v = create_parsing_error(offset, "unterminated string");
             return running - input;
         }
@@ -182,14 +272,17 @@ static int value_parse_string(char* input, value** v, size_t offset) {
     return length;
 }
 
-static int value_parse_expr(char* input, value* v, char end, size_t offset) {
+// parses the input up to the limit (or up to the '\0', whichever comes first)
+static int value_parse_expr(char* input, char* limit, value* v, char end, size_t offset) {
     size_t pos = 0;
     char* running = input;
-    while (*running != end) {
+    while (running == limit || *running != end) {
         pos = offset + (running - input);
-        if (*running == '\0') {
-            value* error = create_parsing_error(pos, "missing '%c'", end);
-            value_add_child(v, error);
+        if (running == limit || *running == '\0') {
+            if (end != '\0') {
+                value* error = create_parsing_error(pos, "missing '%c'", end);
+                value_add_child(v, error);
+            }
             break;
         } else if (strchr(whitespace_chars, *running)) {
             running++;
@@ -199,35 +292,35 @@ static int value_parse_expr(char* input, value* v, char end, size_t offset) {
             break;
         } else if (*running == ';') {
             // comment till the end of the line
-            while (!strchr("\r\n\0", *running)) {
+            while (running < limit && !strchr("\r\n\0", *running)) {
                 running++;
             }
-        } else if (*running == '(') {
+        } else if (*running == '(' || *running == '{') {
+            char close = (*running == '(') ? ')' : '}';
+            value* expr = (*running == '(') ? value_new_sexpr() : value_new_qexpr();
             running++;
-            value* sexpr = value_new_sexpr();
-            running += value_parse_expr(running, sexpr, ')', pos + 1) + 1;
-            value_add_child(v, sexpr);
-        } else if (*running == '{') {
+            running += value_parse_expr(running, limit, expr, close, pos + 1);
+            value_add_child(v, expr);
+            if (running == limit || *running != close) {
+                break;  // the error is already in the nested expression
+            }
             running++;
-            value* qexpr = value_new_qexpr();
-            running += value_parse_expr(running, qexpr, '}', pos + 1) + 1;
-            value_add_child(v, qexpr);
         } else if (*running == '#') {
             value* special = NULL;
-            running += value_parse_special(running, &special, pos);
+            running += value_parse_special(running, limit, &special, pos);
             value_add_child(v, special);
         } else if (*running == '\"') {
             value* string = NULL;
-            running += value_parse_string(running, &string, pos);
+            running += value_parse_string(running, limit, &string, pos);
             value_add_child(v, string);
         } else if (strchr(symbol_chars, *running)) {
             value* symbol = NULL;
-            running += value_parse_symbol(running, &symbol, pos);
+            running += value_parse_symbol(running, limit, &symbol, pos);
             value_add_child(v, symbol);
         } else {
             value* error = create_parsing_error(pos, "unexpected symbol '%c'", *running);
             value_add_child(v, error);
-            running += strlen(running);
+            running = limit;
             break;
         }
     }
@@ -253,7 +346,389 @@ static value* find_error(value* v) {
 
 value* value_parse(char* input) {
     value* v = value_new_sexpr();
-    value_parse_expr(input, v, 0, 1);
+    value_parse_expr(input, input + strlen(input), v, 0, 1);
+
+    value* e = find_error(v);
+    if (e != NULL) {
+        value* temp = value_new_error(e->symbol);
+        value_dispose(v);
+        v = temp;
+    }
+
+    return v;
+}
+
+#define READER_CHUNK_SIZE 65536
+
+#define PARSE_MAX_THREADS 64
+#define PARSE_MIN_CHUNK_SIZE 65536
+#define PARSE_BATCH_SIZE 1048576
+#define PARSE_PARALLEL_SIZE 1048576
+
+static int reader_map(reader* r) {
+    struct stat st;
+    if (fstat(fileno(r->file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return 0;
+    }
+
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(r->file), 0);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+    posix_madvise(mapped, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    r->buffer = mapped;
+    r->length = st.st_size;
+    r->capacity = st.st_size;
+    r->mapped = 1;
+    r->eof = 1;  // the whole file is already in the buffer
+
+    return 1;
+}
+
+void reader_init(reader* r, FILE* file) {
+    r->file = file;
+    r->batch = NULL;
+    r->start = 0;
+    r->offset = 0;
+    r->mapped = 0;
+
+    // regular files are parsed directly from the page cache,
+    // anything else (e.g., pipes) is read through a buffer
+    if (!reader_map(r)) {
+        r->capacity = READER_CHUNK_SIZE;
+        r->buffer = malloc(r->capacity);
+        r->length = 0;
+        r->eof = 0;
+    }
+}
+
+void reader_dispose(reader* r) {
+    if (r->batch != NULL) {
+        value_dispose(r->batch);
+    }
+
+    if (r->mapped) {
+        munmap(r->buffer, r->capacity);
+    } else {
+        free(r->buffer);
+    }
+}
+
+static int reader_fill(reader* r) {
+    if (r->eof) {
+        return 0;
+    }
+
+    if (r->start > 0) {
+        // drop the consumed input, keeping the form being scanned
+        memmove(r->buffer, r->buffer + r->start, r->length - r->start);
+        r->offset += r->start;
+        r->length -= r->start;
+        r->start = 0;
+    }
+
+    if (r->capacity - r->length < READER_CHUNK_SIZE) {
+        r->capacity = r->length + READER_CHUNK_SIZE;
+        if (r->capacity < 2 * r->length) {
+            r->capacity = 2 * r->length;
+        }
+        r->buffer = realloc(r->buffer, r->capacity);
+    }
+
+    size_t read = fread(r->buffer + r->length, 1, r->capacity - r->length, r->file);
+    if (read == 0) {
+        r->eof = 1;
+    }
+    r->length += read;
+
+    return read > 0;
+}
+
+// returns the character at the position relative to the
+// unconsumed input, reading more of the stream if needed
+static int reader_peek(reader* r, size_t pos) {
+    while (r->start + pos >= r->length) {
+        if (!reader_fill(r)) {
+            return EOF;
+        }
+    }
+
+    // unsigned, for a 0xFF byte not to read as EOF
+    return (unsigned char)r->buffer[r->start + pos];
+}
+
+static size_t reader_skip_comment(reader* r, size_t pos) {
+    int c = reader_peek(r, pos);
+    while (c != EOF && c != '\r' && c != '\n') {
+        c = reader_peek(r, ++pos);
+    }
+
+    return pos;
+}
+
+static size_t reader_skip_string(reader* r, size_t pos) {
+    // pos points at the opening quote
+    int prev = reader_peek(r, pos++);
+    int c = reader_peek(r, pos);
+    while (c != EOF && !(c == '\"' && prev != '\\')) {
+        prev = c;
+        c = reader_peek(r, ++pos);
+    }
+
+    return (c == EOF) ? pos : pos + 1;
+}
+
+static size_t reader_skip_expr(reader* r, size_t pos) {
+    int depth = 0;
+    int c = reader_peek(r, pos);
+    while (c != EOF) {
+        if (c == '\"') {
+            pos = reader_skip_string(r, pos);
+        } else if (c == ';') {
+            pos = reader_skip_comment(r, pos);
+        } else if (c == '(' || c == '{') {
+            depth++;
+            pos++;
+        } else if (c == ')' || c == '}') {
+            depth--;
+            pos++;
+            if (depth == 0) {
+                break;
+            }
+        } else {
+            pos++;
+        }
+        c = reader_peek(r, pos);
+    }
+
+    return pos;
+}
+
+// finds the length of the top-level form at the
+// beginning of the unconsumed input of the reader
+static size_t reader_scan_form(reader* r) {
+    size_t pos = 0;
+    int c = reader_peek(r, pos);
+
+    if (c == '(' || c == '{') {
+        pos = reader_skip_expr(r, pos);
+    } else if (c == '\"') {
+        pos = reader_skip_string(r, pos);
+    } else if (c == '#') {
+        pos++;
+        c = reader_peek(r, pos);
+        while (c != EOF && c != '\0' && strchr(alpha_chars, c)) {
+            c = reader_peek(r, ++pos);
+        }
+    } else if (strchr(symbol_chars, c)) {
+        while (c != EOF && c != '\0' && strchr(symbol_chars, c)) {
+            c = reader_peek(r, ++pos);
+        }
+    } else {
+        pos++;  // a single unexpected character
+    }
+
+    return pos;
+}
+
+// skips whitespace and comments before the next form and
+// returns its first character (or EOF if there is none)
+static int reader_skip_space(reader* r) {
+    int c = reader_peek(r, 0);
+    while (c != EOF && c != '\0' && (strchr(whitespace_chars, c) || c == ';')) {
+        if (c == ';') {
+            r->start += reader_skip_comment(r, 0);
+        } else {
+            r->start++;
+        }
+        c = reader_peek(r, 0);
+    }
+
+    return (c == '\0') ? EOF : c;
+}
+
+typedef struct parse_chunk {
+    char* input;
+    char* limit;
+    size_t offset;
+    value* result;
+    pthread_t thread;
+    int started;
+} parse_chunk;
+
+static void* parse_chunk_run(void* arg) {
+    parse_chunk* chunk = arg;
+    chunk->result = value_new_sexpr();
+    value_parse_expr(chunk->input, chunk->limit, chunk->result, 0, chunk->offset);
+
+    return NULL;
+}
+
+static size_t get_num_threads() {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1) {
+        return 1;
+    } else if (num_cpus > PARSE_MAX_THREADS) {
+        return PARSE_MAX_THREADS;
+    } else {
+        return num_cpus;
+    }
+}
+
+// splits off the top-level forms at the beginning of the (fully buffered)
+// input of the reader, up to about max_length bytes, into contiguous chunks
+// and parses the chunks on separate threads; the result holds the forms in
+// their original order, just like a sequential parse would
+static value* reader_parse_batch(reader* r, size_t max_length, size_t num_threads) {
+    size_t begin = r->start;
+    size_t total = r->length - r->start;
+    if (total > max_length) {
+        total = max_length;
+    }
+
+    size_t target = total / num_threads;
+    if (target < PARSE_MIN_CHUNK_SIZE) {
+        target = PARSE_MIN_CHUNK_SIZE;
+    }
+
+    parse_chunk chunks[PARSE_MAX_THREADS];
+    size_t num_chunks = 0;
+    size_t chunk_start = r->start;
+
+    // the splitting only scans for the form boundaries,
+    // which is much cheaper than the parsing itself
+    while (reader_skip_space(r) != EOF && r->start - begin < max_length) {
+        r->start += reader_scan_form(r);
+        if (r->start - chunk_start >= target && num_chunks < num_threads - 1) {
+            chunks[num_chunks].input = r->buffer + chunk_start;
+            chunks[num_chunks].limit = r->buffer + r->start;
+            chunks[num_chunks].offset = r->offset + chunk_start + 1;
+            num_chunks++;
+            chunk_start = r->start;
+        }
+    }
+
+    if (r->start > chunk_start) {
+        chunks[num_chunks].input = r->buffer + chunk_start;
+        chunks[num_chunks].limit = r->buffer + r->start;
+        chunks[num_chunks].offset = r->offset + chunk_start + 1;
+        num_chunks++;
+    }
+
+    for (size_t i = 1; i < num_chunks; i++) {
+        chunks[i].started = (pthread_create(&chunks[i].thread, NULL, parse_chunk_run, &chunks[i]) == 0);
+        if (!chunks[i].started) {
+            parse_chunk_run(&chunks[i]);
+        }
+    }
+    if (num_chunks > 0) {
+        parse_chunk_run(&chunks[0]);
+    }
+
+    value* batch = value_new_sexpr();
+    for (size_t i = 0; i < num_chunks; i++) {
+        if (i > 0 && chunks[i].started) {
+            pthread_join(chunks[i].thread, NULL);
+        }
+
+        value* result = chunks[i].result;
+        for (size_t j = 0; j < result->num_children; j++) {
+            value_add_child(batch, result->children[j]);
+        }
+        result->num_children = 0;  // the children are moved
+        value_dispose(result);
+    }
+
+    return batch;
+}
+
+static value* reader_next_batched(reader* r) {
+    if (r->batch != NULL && r->batch_next == r->batch->num_children) {
+        value_dispose(r->batch);
+        r->batch = NULL;
+    }
+
+    if (r->batch == NULL) {
+        size_t num_threads = get_num_threads();
+        r->batch = reader_parse_batch(r, num_threads * PARSE_BATCH_SIZE, num_threads);
+        r->batch_next = 0;
+    }
+
+    if (r->batch->num_children == 0) {
+        return NULL;
+    }
+
+    value* v = r->batch->children[r->batch_next];
+    r->batch->children[r->batch_next] = NULL;  // don't dispose
+    r->batch_next++;
+
+    value* e = find_error(v);
+    if (e != NULL) {
+        value* temp = value_new_error(e->symbol);
+        value_dispose(v);
+        v = temp;
+
+        // nothing is read past a parsing error
+        r->batch_next = r->batch->num_children;
+        r->start = r->length;
+    }
+
+    return v;
+}
+
+value* reader_next(reader* r) {
+    if (r->batch != NULL || (r->mapped && r->length - r->start >= PARSE_PARALLEL_SIZE)) {
+        return reader_next_batched(r);
+    }
+
+    if (reader_skip_space(r) == EOF) {
+        return NULL;
+    }
+
+    size_t length = reader_scan_form(r);
+    char* form = r->buffer + r->start;
+
+    value* v = value_new_sexpr();
+    value_parse_expr(form, form + length, v, 0, r->offset + r->start + 1);
+
+    r->start += length;
+
+    value* e = find_error(v);
+    if (e != NULL) {
+        value* temp = value_new_error(e->symbol);
+        value_dispose(v);
+        v = temp;
+    } else {
+        value* temp = v->children[0];
+        v->children[0] = NULL;  // don't dispose
+        value_dispose(v);
+        v = temp;
+    }
+
+    return v;
+}
+
+value* value_parse_parallel(char* input, size_t num_threads) {
+    if (num_threads < 1) {
+        num_threads = get_num_threads();
+    } else if (num_threads > PARSE_MAX_THREADS) {
+        num_threads = PARSE_MAX_THREADS;
+    }
+
+    // the input is read in place, so the reader needs no disposal
+    reader r;
+    r.file = NULL;
+    r.buffer = input;
+    r.start = 0;
+    r.length = strlen(input);
+    r.capacity = r.length;
+    r.offset = 0;
+    r.mapped = 0;
+    r.eof = 1;
+    r.batch = NULL;
+
+    value* v = reader_parse_batch(&r, r.length, num_threads);
 
     value* e = find_error(v);
     if (e != NULL) {
@@ -1,8 +1,28 @@
 #ifndef PARSE_H_
 #define PARSE_H_
 
+#include <stdio.h>
+
 #include "value.h"
 
+typedef struct reader {
+    FILE* file;
+    char* buffer;
+    size_t start;
+    size_t length;
+    size_t capacity;
+    size_t offset;
+    int mapped;
+    int eof;
+    value* batch;
+    size_t batch_next;
+} reader;
+
 value* value_parse(char* input);
+value* value_parse_parallel(char* input, size_t num_threads);
+
+void reader_init(reader* r, FILE* file);
+void reader_dispose(reader* r);
+value* reader_next(reader* r);
 
 #endif  // PARSE_H_
@@ -0,0 +1,322 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define POOL_MAX_THREADS 64
+#define POOL_THREADS_VARIABLE "MYLISP_THREADS"
+#define POOL_SPAWN_CUTOFF 4
+#define POOL_INITIAL_DEQUE_CAPACITY 16
+
+// a job is a number of tasks, which the workers and the caller
+// of pool_run claim one at a time; a caller only ever waits for
+// the tasks of its job that are already running elsewhere, so
+// jobs can be nested (started from within tasks) without deadlocks
+typedef struct pool_job {
+    pool_fn fn;
+    void* arg;
+    size_t num_tasks;
+    size_t num_claimed;
+    size_t num_done;
+    int detached;
+    struct pool_job* next;
+} pool_job;
+
+// a spawned task goes onto the deque of the spawning thread: the
+// owner takes the latest task (depth first, while its data is hot)
+// from the bottom, other threads steal the oldest (and likely the
+// largest) ones from the top; the deque of index 0 is shared by
+// the threads outside of the pool
+typedef struct pool_task {
+    pool_fn fn;
+    void* arg;
+} pool_task;
+
+typedef struct pool_deque {
+    pool_task* tasks;
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t mutex;
+} pool_deque;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static pool_job* pool_jobs = NULL;  // the jobs with unclaimed tasks
+static size_t pool_num_threads = 1;
+
+static pool_deque pool_deques[POOL_MAX_THREADS];
+static size_t pool_num_spawned = 0;  // the tasks in all deques
+static size_t pool_num_idle = 0;     // the workers waiting for work
+static __thread size_t pool_deque_index = 0;
+
+// must be called under the mutex
+static int claim_task(pool_job* job, size_t* index) {
+    if (job->num_claimed == job->num_tasks) {
+        return 0;
+    }
+
+    *index = job->num_claimed++;
+    if (job->num_claimed == job->num_tasks) {
+        pool_job** link = &pool_jobs;
+        while (*link != NULL && *link != job) {
+            link = &(*link)->next;
+        }
+        if (*link == job) {
+            *link = job->next;
+        }
+    }
+
+    return 1;
+}
+
+// must be called under the mutex
+static void run_task(pool_job* job, size_t index) {
+    pthread_mutex_unlock(&pool_mutex);
+    job->fn(job->arg, index);
+    pthread_mutex_lock(&pool_mutex);
+
+    if (++job->num_done == job->num_tasks) {
+        if (job->detached) {
+            // nobody waits for a submitted job
+            free(job);
+        } else {
+            pthread_cond_broadcast(&pool_done);
+        }
+    }
+}
+
+static int pop_task(pool_deque* deque, pool_task* task) {
+    pthread_mutex_lock(&deque->mutex);
+    int popped = (deque->bottom > deque->top);
+    if (popped) {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->mutex);
+
+    return popped;
+}
+
+static int steal_task(pool_deque* deque, pool_task* task) {
+    pthread_mutex_lock(&deque->mutex);
+    int stolen = (deque->bottom > deque->top);
+    if (stolen) {
+        *task = deque->tasks[deque->top % deque->capacity];
+        deque->top++;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+
+    return stolen;
+}
+
+static void* pool_worker(void* arg) {
+    pool_deque_index = (size_t)arg;
+
+    pthread_mutex_lock(&pool_mutex);
+
+    while (1) {
+        if (pool_jobs != NULL) {
+            size_t index;
+            pool_job* job = pool_jobs;
+            if (claim_task(job, &index)) {
+                run_task(job, index);
+            }
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool_mutex);
+        int helped = pool_help();
+        pthread_mutex_lock(&pool_mutex);
+
+        if (!helped) {
+            // the spawner reads the idle count after counting its task,
+            // the worker reads the task count after counting itself idle,
+            // so at least one of them sees the other
+            __atomic_add_fetch(&pool_num_idle, 1, __ATOMIC_SEQ_CST);
+            while (pool_jobs == NULL && __atomic_load_n(&pool_num_spawned, __ATOMIC_SEQ_CST) == 0) {
+                pthread_cond_wait(&pool_work, &pool_mutex);
+            }
+            __atomic_sub_fetch(&pool_num_idle, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    return NULL;
+}
+
+static void pool_init() {
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    char* variable = getenv(POOL_THREADS_VARIABLE);
+    if (variable != NULL && atol(variable) > 0) {
+        num_threads = atol(variable);
+    }
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    } else if (num_threads > POOL_MAX_THREADS) {
+        num_threads = POOL_MAX_THREADS;
+    }
+
+    for (long i = 0; i < num_threads; i++) {
+        pool_deques[i].tasks = NULL;
+        pool_deques[i].capacity = 0;
+        pool_deques[i].top = 0;
+        pool_deques[i].bottom = 0;
+        pthread_mutex_init(&pool_deques[i].mutex, NULL);
+    }
+
+    // the callers of pool_run make up for the missing thread
+    for (long i = 0; i < num_threads - 1; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, (void*)pool_num_threads) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        pool_num_threads++;
+    }
+}
+
+size_t pool_get_num_threads() {
+    pthread_once(&pool_once, pool_init);
+
+    return pool_num_threads;
+}
+
+void pool_run(pool_fn fn, void* arg, size_t num_tasks) {
+    if (num_tasks == 0) {
+        return;
+    }
+
+    pthread_once(&pool_once, pool_init);
+
+    pool_job job;
+    job.fn = fn;
+    job.arg = arg;
+    job.num_tasks = num_tasks;
+    job.num_claimed = 0;
+    job.num_done = 0;
+    job.detached = 0;
+
+    pthread_mutex_lock(&pool_mutex);
+
+    // the latest (likely nested) job is worked on first
+    if (pool_num_threads > 1 && num_tasks > 1) {
+        job.next = pool_jobs;
+        pool_jobs = &job;
+        pthread_cond_broadcast(&pool_work);
+    }
+
+    size_t index;
+    while (claim_task(&job, &index)) {
+        run_task(&job, index);
+    }
+
+    while (job.num_done < job.num_tasks) {
+        pthread_cond_wait(&pool_done, &pool_mutex);
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+int pool_submit(pool_fn fn, void* arg) {
+    pthread_once(&pool_once, pool_init);
+
+    if (pool_num_threads == 1) {
+        // no worker would ever run the task
+        return 0;
+    }
+
+    pool_job* job = malloc(sizeof(pool_job));
+    job->fn = fn;
+    job->arg = arg;
+    job->num_tasks = 1;
+    job->num_claimed = 0;
+    job->num_done = 0;
+    job->detached = 1;
+
+    pthread_mutex_lock(&pool_mutex);
+    job->next = pool_jobs;
+    pool_jobs = job;
+    pthread_cond_signal(&pool_work);
+    pthread_mutex_unlock(&pool_mutex);
+
+    return 1;
+}
+
+int pool_should_spawn() {
+    pthread_once(&pool_once, pool_init);
+
+    if (pool_num_threads == 1) {
+        // no worker would ever steal the task
+        return 0;
+    }
+
+    // with enough tasks waiting to be stolen already,
+    // the caller is better off running the next one
+    pool_deque* deque = &pool_deques[pool_deque_index];
+    pthread_mutex_lock(&deque->mutex);
+    size_t size = deque->bottom - deque->top;
+    pthread_mutex_unlock(&deque->mutex);
+
+    return size < POOL_SPAWN_CUTOFF;
+}
+
+int pool_spawn(pool_fn fn, void* arg) {
+    pthread_once(&pool_once, pool_init);
+
+    if (pool_num_threads == 1) {
+        return 0;
+    }
+
+    pool_deque* deque = &pool_deques[pool_deque_index];
+
+    pthread_mutex_lock(&deque->mutex);
+    size_t size = deque->bottom - deque->top;
+    if (size == deque->capacity) {
+        size_t capacity = (deque->capacity == 0) ? POOL_INITIAL_DEQUE_CAPACITY : deque->capacity * 2;
+        pool_task* tasks = malloc(capacity * sizeof(pool_task));
+        for (size_t i = 0; i < size; i++) {
+            tasks[i] = deque->tasks[(deque->top + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->top = 0;
+        deque->bottom = size;
+    }
+    deque->tasks[deque->bottom % deque->capacity].fn = fn;
+    deque->tasks[deque->bottom % deque->capacity].arg = arg;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->mutex);
+
+    __atomic_add_fetch(&pool_num_spawned, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool_num_idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool_mutex);
+        pthread_cond_signal(&pool_work);
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    return 1;
+}
+
+int pool_help() {
+    pthread_once(&pool_once, pool_init);
+
+    pool_task task;
+    int found = pop_task(&pool_deques[pool_deque_index], &task);
+    for (size_t i = 1; !found && i < pool_num_threads; i++) {
+        found = steal_task(&pool_deques[(pool_deque_index + i) % pool_num_threads], &task);
+    }
+
+    if (found) {
+        __atomic_sub_fetch(&pool_num_spawned, 1, __ATOMIC_SEQ_CST);
+        task.fn(task.arg, 0);
+    }
+
+    return found;
+}
@@ -0,0 +1,15 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+typedef void (*pool_fn)(void* arg, size_t index);
+
+size_t pool_get_num_threads();
+void pool_run(pool_fn fn, void* arg, size_t num_tasks);
+int pool_submit(pool_fn fn, void* arg);
+int pool_should_spawn();
+int pool_spawn(pool_fn fn, void* arg);
+int pool_help();
+
+#endif  // POOL_H_
@@ -7,6 +7,7 @@
 #include "edit.h"
 #include "env.h"
 #include "eval.h"
+#include "image.h"
 #include "parse.h"
 #include "value.h"
 
@@ -78,14 +79,16 @@ static void process_repl_command(environment* env, char* input, char* output) {
     value_dispose(v);
 }
 
-void run_repl() {
+int run_repl(char* image) {
+    environment env;
+    if (!image_init_environment(&env, image)) {
+        fprintf(stderr, "failed to restore image: %s\n", image);
+        return 1;
+    }
+
     printf("mylisp version 0.0.1\n");
     printf("type in \"q\" to quit\n\n");
 
-    environment env;
-    environment_init(&env);
-    environment_register_builtins(&env);
-
     int stop = 0;
     char input[65536];
     char output[65536];
@@ -112,4 +115,6 @@ void run_repl() {
     environment_dispose(&env);
 
     printf("\nbye!\n");
+
+    return 0;
 }
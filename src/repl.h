@@ -1,6 +1,6 @@
 #ifndef REPL_H_
 #define REPL_H_
 
-void run_repl();
+int run_repl(char* image);
 
 #endif  // REPL_H_
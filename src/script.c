@@ -0,0 +1,203 @@
+#include "script.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "env.h"
+#include "eval.h"
+#include "image.h"
+#include "parse.h"
+#include "value.h"
+
+#define SCRIPT_BUFFER_SIZE 1048576
+
+script_streams* get_std_streams() {
+    static script_streams streams;
+
+    if (streams.in == NULL) {
+        setvbuf(stdin, NULL, _IOFBF, SCRIPT_BUFFER_SIZE);
+        setvbuf(stdout, NULL, _IOFBF, SCRIPT_BUFFER_SIZE);
+
+        streams.in = stdin;
+        streams.out = stdout;
+        streams.err = stderr;
+    }
+
+    return &streams;
+}
+
+static int init_script_environment(
+    environment* env, script_streams* s, char* image, char* name, int argc, char** argv) {
+    if (!image_init_environment(env, image)) {
+        fprintf(s->err, "failed to restore image: %s\n", image);
+        return 0;
+    }
+    environment_get_context(env)->output = s->out;
+
+    // the script's arguments are bound to argv, preceded by its name
+    value* args = value_new_qexpr();
+    value_add_child(args, value_new_string(name));
+    for (int i = 0; i < argc; i++) {
+        value_add_child(args, value_new_string(argv[i]));
+    }
+    environment_put(env, "argv", args, 0);
+    value_dispose(args);
+
+    return 1;
+}
+
+int run_script(script_streams* s, char* image, char* path, int argc, char** argv) {
+    FILE* file = (strcmp(path, "-") == 0) ? s->in : fopen(path, "r");
+    if (file == NULL) {
+        fprintf(s->err, "failed to open file: %s\n", path);
+        return 1;
+    }
+
+    environment env;
+    if (!init_script_environment(&env, s, image, path, argc, argv)) {
+        if (file != s->in) {
+            fclose(file);
+        }
+        return 1;
+    }
+
+    reader r;
+    reader_init(&r, file);
+
+    // the forms are evaluated one by one and
+    // the first error terminates the script
+    int status = 0;
+    value* form = NULL;
+    while (status == 0 && (form = reader_next(&r)) != NULL) {
+        value* e = form;
+        if (form->type != VALUE_ERROR) {
+            e = value_evaluate(form, &env);
+            value_dispose(form);
+        }
+
+        if (e->type == VALUE_ERROR) {
+            fflush(s->out);
+            fprintf(s->err, "%s: %s\n", path, e->symbol);
+            status = 1;
+        }
+        value_dispose(e);
+    }
+
+    if (status == 0 && ferror(file)) {
+        fprintf(s->err, "error reading from file: %s\n", path);
+        status = 1;
+    }
+
+    reader_dispose(&r);
+    if (file != s->in) {
+        fclose(file);
+    }
+    environment_dispose(&env);
+
+    fflush(s->out);
+
+    return status;
+}
+
+int run_expression(script_streams* s, char* image, char* expression, int argc, char** argv) {
+    environment env;
+    if (!init_script_environment(&env, s, image, "-e", argc, argv)) {
+        return 1;
+    }
+
+    value* v = value_parse(expression);
+    if (v->type != VALUE_ERROR) {
+        value* e = value_evaluate(v, &env);
+        value_dispose(v);
+        v = e;
+    }
+
+    int status = 0;
+    if (v->type == VALUE_ERROR) {
+        fflush(s->out);
+        fprintf(s->err, "%s\n", v->symbol);
+        status = 1;
+    } else if (v->type != VALUE_SEXPR || v->num_children > 0) {
+        // the empty s-expr (e.g., from print) is not echoed
+        value_print(v, s->out);
+        fputc('\n', s->out);
+    }
+
+    value_dispose(v);
+    environment_dispose(&env);
+
+    fflush(s->out);
+
+    return status;
+}
+
+static void print_line_result(value* v, FILE* output) {
+    if (v->type == VALUE_STRING) {
+        // strings are written raw, as awk would print them
+        fputs(v->symbol, output);
+        fputc('\n', output);
+    } else if (v->type != VALUE_SEXPR || v->num_children > 0) {
+        value_print(v, output);
+        fputc('\n', output);
+    }
+}
+
+int run_lines(script_streams* s, char* image, char* expression, int argc, char** argv) {
+    environment env;
+    if (!init_script_environment(&env, s, image, "-n", argc, argv)) {
+        return 1;
+    }
+
+    // the expression is parsed once and evaluated for every
+    // line of stdin, bound to line (without the newline) and
+    // its 1-based number bound to nr
+    value* v = value_parse(expression);
+    if (v->type == VALUE_ERROR) {
+        fprintf(s->err, "%s\n", v->symbol);
+        value_dispose(v);
+        environment_dispose(&env);
+        return 1;
+    }
+
+    int status = 0;
+    char* buffer = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    size_t number = 0;
+    while (status == 0 && (length = getline(&buffer, &capacity, s->in)) != -1) {
+        if (length > 0 && buffer[length - 1] == '\n') {
+            buffer[length - 1] = '\0';
+        }
+
+        value* line = value_new_string(buffer);
+        value* nr = value_new_integer(++number);
+        environment_put(&env, "line", line, 0);
+        environment_put(&env, "nr", nr, 0);
+        value_dispose(line);
+        value_dispose(nr);
+
+        value* e = value_evaluate(v, &env);
+        if (e->type == VALUE_ERROR) {
+            fflush(s->out);
+            fprintf(s->err, "line %zu: %s\n", number, e->symbol);
+            status = 1;
+        } else {
+            print_line_result(e, s->out);
+        }
+        value_dispose(e);
+    }
+
+    if (status == 0 && ferror(s->in)) {
+        fprintf(s->err, "error reading from stdin\n");
+        status = 1;
+    }
+
+    free(buffer);
+    value_dispose(v);
+    environment_dispose(&env);
+
+    fflush(s->out);
+
+    return status;
+}
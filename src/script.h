@@ -0,0 +1,20 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#include <stdio.h>
+
+// the streams a script reads from and writes to: the standard
+// ones from the command line, and any others in the tests
+typedef struct script_streams {
+    FILE* in;
+    FILE* out;
+    FILE* err;
+} script_streams;
+
+script_streams* get_std_streams();
+
+int run_script(script_streams* s, char* image, char* path, int argc, char** argv);
+int run_expression(script_streams* s, char* image, char* expression, int argc, char** argv);
+int run_lines(script_streams* s, char* image, char* expression, int argc, char** argv);
+
+#endif  // SCRIPT_H_
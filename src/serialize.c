@@ -0,0 +1,360 @@
+#include "serialize.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "eval.h"
+#include "map.h"
+#include "value.h"
+
+// the binary format is meant for caches on the same machine, so
+// non-integral numbers and array elements are written as is, in
+// the native byte order; lengths, integers and integral numbers
+// are written as variable-length integers
+
+#define TAG_INTEGRAL 0x80
+#define MAX_INTEGRAL 9007199254740992.0  // 2^53
+
+#define FUNCTION_BUILTIN 0
+#define FUNCTION_LAMBDA 1
+
+static int write_bytes(FILE* file, void* data, size_t length) {
+    return fwrite(data, 1, length, file) == length;
+}
+
+static int write_length(FILE* file, uint64_t length) {
+    uint8_t buffer[10];
+    size_t size = 0;
+    do {
+        buffer[size] = length & 0x7F;
+        length >>= 7;
+        if (length != 0) {
+            buffer[size] |= 0x80;
+        }
+        size++;
+    } while (length != 0);
+
+    return write_bytes(file, buffer, size);
+}
+
+static int write_number(FILE* file, double number) {
+    uint8_t tag = VALUE_NUMBER;
+    if (number > -MAX_INTEGRAL && number < MAX_INTEGRAL &&
+        number == (int64_t)number && !(number == 0 && signbit(number))) {
+        // zigzag encoding keeps small negative numbers short
+        int64_t integral = (int64_t)number;
+        uint64_t zigzag = ((uint64_t)integral << 1) ^ (uint64_t)(integral >> 63);
+        tag |= TAG_INTEGRAL;
+        return write_bytes(file, &tag, sizeof(tag)) && write_length(file, zigzag);
+    } else {
+        return write_bytes(file, &tag, sizeof(tag)) && write_bytes(file, &number, sizeof(number));
+    }
+}
+
+static int write_integer(FILE* file, int64_t integer) {
+    uint8_t tag = VALUE_INTEGER;
+    uint64_t zigzag = ((uint64_t)integer << 1) ^ (uint64_t)(integer >> 63);
+    return write_bytes(file, &tag, sizeof(tag)) && write_length(file, zigzag);
+}
+
+static int write_symbol(FILE* file, char* symbol) {
+    size_t length = (symbol != NULL) ? strlen(symbol) : 0;
+    return write_length(file, length) && write_bytes(file, symbol, length);
+}
+
+static int write_function(FILE* file, value* v) {
+    uint8_t kind;
+    if (v->builtin != NULL) {
+        // builtins are stored by their registered name,
+        // as function pointers don't survive across processes
+        char* builtin_name = get_builtin_name(v->builtin);
+        if (builtin_name == NULL) {
+            return 0;
+        }
+        kind = FUNCTION_BUILTIN;
+        return write_bytes(file, &kind, sizeof(kind)) &&
+               write_symbol(file, builtin_name) &&
+               write_symbol(file, v->symbol);
+    } else {
+        // an unnamed lambda is stored with an empty symbol
+        kind = FUNCTION_LAMBDA;
+        return write_bytes(file, &kind, sizeof(kind)) &&
+               write_symbol(file, v->symbol) &&
+               value_serialize(v->args, file) &&
+               value_serialize(v->body, file);
+    }
+}
+
+// a map is written as a q-expr of its {key value} pairs
+static int write_map(FILE* file, value* v) {
+    value* items = map_items(v->map);
+    int written = write_length(file, items->num_children);
+    for (size_t i = 0; written && i < items->num_children; i++) {
+        written = value_serialize(items->children[i]->children[0], file) &&
+                  value_serialize(items->children[i]->children[1], file);
+    }
+    value_dispose(items);
+
+    return written;
+}
+
+static int read_bytes(char** running, char* limit, void* data, size_t length) {
+    if ((size_t)(limit - *running) < length) {
+        return 0;
+    }
+
+    memcpy(data, *running, length);
+    *running += length;
+
+    return 1;
+}
+
+static int read_varint(char** running, char* limit, uint64_t* result) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*running == limit) {
+            return 0;
+        }
+
+        uint8_t byte = *(*running)++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *result = value;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int read_length(char** running, char* limit, size_t* length) {
+    uint64_t l;
+    if (!read_varint(running, limit, &l) || l > (uint64_t)(limit - *running)) {
+        return 0;
+    }
+    *length = l;
+
+    return 1;
+}
+
+static char* read_symbol(char** running, char* limit) {
+    size_t length;
+    if (!read_length(running, limit, &length)) {
+        return NULL;
+    }
+
+    char* symbol = malloc(length + 1);
+    memcpy(symbol, *running, length);
+    symbol[length] = '\0';
+    *running += length;
+
+    return symbol;
+}
+
+static value* read_function(char** running, char* limit) {
+    uint8_t kind;
+    if (!read_bytes(running, limit, &kind, sizeof(kind))) {
+        return NULL;
+    }
+
+    value* result = NULL;
+    if (kind == FUNCTION_BUILTIN) {
+        char* builtin_name = read_symbol(running, limit);
+        if (builtin_name == NULL) {
+            return NULL;
+        }
+
+        value_fn builtin = get_builtin(builtin_name);
+        char* symbol = read_symbol(running, limit);
+        if (builtin != NULL && symbol != NULL) {
+            result = value_new_function_builtin(builtin, symbol);
+        }
+
+        free(builtin_name);
+        free(symbol);
+    } else if (kind == FUNCTION_LAMBDA) {
+        char* symbol = read_symbol(running, limit);
+        if (symbol == NULL) {
+            return NULL;
+        }
+
+        value* args = value_deserialize(running, limit);
+        value* body = (args != NULL) ? value_deserialize(running, limit) : NULL;
+        if (body != NULL && args->type == VALUE_QEXPR && body->type == VALUE_QEXPR) {
+            // args and body are moved into the lambda without copying
+            result = malloc(sizeof(value));
+            result->type = VALUE_FUNCTION;
+            result->builtin = NULL;
+            result->symbol = NULL;
+            result->args = args;
+            result->body = body;
+            if (symbol[0] != '\0') {
+                result->symbol = symbol;
+                symbol = NULL;
+            }
+        } else {
+            if (args != NULL) {
+                value_dispose(args);
+            }
+            if (body != NULL) {
+                value_dispose(body);
+            }
+        }
+
+        free(symbol);
+    }
+
+    return result;
+}
+
+int value_serialize(value* v, FILE* file) {
+    if (v->type == VALUE_NUMBER) {
+        return write_number(file, v->number);
+    } else if (v->type == VALUE_INTEGER) {
+        return write_integer(file, v->integer);
+    }
+
+    uint8_t type = v->type;
+    if (!write_bytes(file, &type, sizeof(type))) {
+        return 0;
+    }
+
+    uint8_t truth;
+
+    switch (v->type) {
+        case VALUE_SYMBOL:
+        case VALUE_ERROR:
+        case VALUE_INFO:
+        case VALUE_STRING:
+            return write_symbol(file, v->symbol);
+        case VALUE_BOOL:
+            truth = v->number;
+            return write_bytes(file, &truth, sizeof(truth));
+        case VALUE_FUNCTION:
+            return write_function(file, v);
+        case VALUE_SEXPR:
+        case VALUE_QEXPR:
+            if (!write_length(file, v->num_children)) {
+                return 0;
+            }
+            for (size_t i = 0; i < v->num_children; i++) {
+                if (!value_serialize(v->children[i], file)) {
+                    return 0;
+                }
+            }
+            return 1;
+        case VALUE_ARRAY:
+            return write_length(file, v->array->length) &&
+                   write_bytes(file, v->array->data, v->array->length * sizeof(double));
+        case VALUE_MAP:
+            return write_map(file, v);
+        default:
+            return 0;
+    }
+}
+
+value* value_deserialize(char** running, char* limit) {
+    uint8_t type;
+    if (!read_bytes(running, limit, &type, sizeof(type))) {
+        return NULL;
+    }
+
+    value* result = NULL;
+    char* symbol = NULL;
+    double number;
+    uint64_t zigzag;
+    uint8_t truth;
+    size_t length;
+
+    switch (type) {
+        case VALUE_NUMBER | TAG_INTEGRAL:
+            if (read_varint(running, limit, &zigzag)) {
+                result = value_new_number((int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1));
+            }
+            break;
+        case VALUE_NUMBER:
+            if (read_bytes(running, limit, &number, sizeof(number))) {
+                result = value_new_number(number);
+            }
+            break;
+        case VALUE_INTEGER:
+            if (read_varint(running, limit, &zigzag)) {
+                result = value_new_integer((int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1));
+            }
+            break;
+        case VALUE_SYMBOL:
+        case VALUE_ERROR:
+        case VALUE_INFO:
+        case VALUE_STRING:
+            symbol = read_symbol(running, limit);
+            if (symbol != NULL) {
+                result = value_new_symbol(symbol);
+                result->type = type;
+                free(symbol);
+            }
+            break;
+        case VALUE_BOOL:
+            if (read_bytes(running, limit, &truth, sizeof(truth))) {
+                result = value_new_bool(truth);
+            }
+            break;
+        case VALUE_FUNCTION:
+            result = read_function(running, limit);
+            break;
+        case VALUE_SEXPR:
+        case VALUE_QEXPR:
+            if (read_length(running, limit, &length)) {
+                result = (type == VALUE_SEXPR) ? value_new_sexpr() : value_new_qexpr();
+                if (length > result->capacity) {
+                    result->capacity = length;
+                    result->children = realloc(result->children, length * sizeof(value*));
+                }
+                for (size_t i = 0; i < length; i++) {
+                    value* child = value_deserialize(running, limit);
+                    if (child == NULL) {
+                        value_dispose(result);
+                        result = NULL;
+                        break;
+                    }
+                    value_add_child(result, child);
+                }
+            }
+            break;
+        case VALUE_ARRAY:
+            if (read_length(running, limit, &length) &&
+                length <= (size_t)(limit - *running) / sizeof(double)) {
+                result = array_new(length);
+                if (result != NULL) {
+                    read_bytes(running, limit, result->array->data, length * sizeof(double));
+                }
+            }
+            break;
+        case VALUE_MAP:
+            if (read_length(running, limit, &length)) {
+                result = map_new();
+                for (size_t i = 0; i < length; i++) {
+                    value* key = value_deserialize(running, limit);
+                    value* v = (key != NULL) ? value_deserialize(running, limit) : NULL;
+                    if (v == NULL || !map_is_hashable(key)) {
+                        if (key != NULL) {
+                            value_dispose(key);
+                        }
+                        if (v != NULL) {
+                            value_dispose(v);
+                        }
+                        value_dispose(result);
+                        result = NULL;
+                        break;
+                    }
+                    map_put(result->map, key, v);
+                }
+            }
+            break;
+    }
+
+    return result;
+}
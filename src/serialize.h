@@ -0,0 +1,11 @@
+#ifndef SERIALIZE_H_
+#define SERIALIZE_H_
+
+#include <stdio.h>
+
+#include "value.h"
+
+int value_serialize(value* v, FILE* file);
+value* value_deserialize(char** running, char* limit);
+
+#endif  // SERIALIZE_H_
@@ -0,0 +1,297 @@
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "eval.h"
+#include "image.h"
+#include "parse.h"
+#include "value.h"
+
+#define STATUS_OK 0
+#define STATUS_ERROR 1
+
+static int write_all(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += written;
+        length -= written;
+    }
+
+    return 1;
+}
+
+static int read_all(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t r = read(fd, data, length);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        } else if (r == 0) {
+            return 0;
+        }
+        data += r;
+        length -= r;
+    }
+
+    return 1;
+}
+
+int write_frame(int fd, char* data, size_t length) {
+    if (length > SERVER_MAX_FRAME_SIZE) {
+        return 0;
+    }
+
+    uint8_t header[4] = {length >> 24, length >> 16, length >> 8, length};
+
+    return write_all(fd, (char*)header, sizeof(header)) && write_all(fd, data, length);
+}
+
+char* read_frame(int fd, size_t* length) {
+    uint8_t header[4];
+    if (!read_all(fd, (char*)header, sizeof(header))) {
+        return NULL;
+    }
+
+    size_t l = ((size_t)header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+    if (l > SERVER_MAX_FRAME_SIZE) {
+        return NULL;
+    }
+
+    // the payload is null-terminated for the parser
+    char* data = malloc(l + 1);
+    if (!read_all(fd, data, l)) {
+        free(data);
+        return NULL;
+    }
+    data[l] = '\0';
+    *length = l;
+
+    return data;
+}
+
+static value* evaluate_request(environment* env, char* request) {
+    value* v = value_parse(request);
+    if (v->type != VALUE_ERROR) {
+        // the request is isolated in a snapshot of the warm
+        // environment: its bindings (even the ones of def) are
+        // dropped with it, and the snapshot shares the bound
+        // values, so it costs no copy of the loaded libraries
+        environment snapshot;
+        environment_snapshot(&snapshot, env);
+
+        value* e = value_evaluate(v, &snapshot);
+        value_dispose(v);
+        v = e;
+
+        environment_dispose(&snapshot);
+    }
+
+    return v;
+}
+
+void serve_connection(environment* env, int fd) {
+    char* request;
+    size_t length;
+    while ((request = read_frame(fd, &length)) != NULL) {
+        value* result = evaluate_request(env, request);
+        free(request);
+
+        char* response = NULL;
+        size_t response_length = 0;
+        FILE* stream = open_memstream(&response, &response_length);
+        fputc((result->type == VALUE_ERROR) ? STATUS_ERROR : STATUS_OK, stream);
+        if (result->type == VALUE_ERROR || result->type == VALUE_INFO) {
+            fputs(result->symbol, stream);
+        } else {
+            value_print(result, stream);
+        }
+        fclose(stream);
+        value_dispose(result);
+
+        int written = write_frame(fd, response, response_length);
+        free(response);
+        if (!written) {
+            break;
+        }
+    }
+}
+
+static int open_socket(char* path, struct sockaddr_un* address) {
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+    }
+
+    return fd;
+}
+
+int run_server(char* image, char* path, int num_files, char** files) {
+    environment env;
+    if (!image_init_environment(&env, image)) {
+        fprintf(stderr, "failed to restore image: %s\n", image);
+        return 1;
+    }
+
+    // the libraries are loaded once and stay warm across requests
+    for (int i = 0; i < num_files; i++) {
+        value* args = value_new_string(files[i]);
+        value* loaded = get_builtin("load")(&args, 1, "load", &env);
+        value_dispose(args);
+
+        int failed = (loaded->type == VALUE_ERROR);
+        if (failed) {
+            fprintf(stderr, "%s: %s\n", files[i], loaded->symbol);
+        }
+        value_dispose(loaded);
+
+        if (failed) {
+            environment_dispose(&env);
+            return 1;
+        }
+    }
+
+    struct sockaddr_un address;
+    int fd = open_socket(path, &address);
+    if (fd == -1) {
+        environment_dispose(&env);
+        return 1;
+    }
+
+    // a stale socket of a previous server is replaced
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror(path);
+        close(fd);
+        environment_dispose(&env);
+        return 1;
+    }
+
+    // a client going away mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "serving on %s\n", path);
+
+    // the connections are served one at a time, as
+    // the global environment is shared by the requests
+    while (1) {
+        int connection = accept(fd, NULL, NULL);
+        if (connection == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+
+        serve_connection(&env, connection);
+        close(connection);
+    }
+
+    close(fd);
+    unlink(path);
+    environment_dispose(&env);
+
+    return 1;
+}
+
+static char* read_stream(FILE* stream, size_t* length) {
+    char* data = NULL;
+    FILE* buffer = open_memstream(&data, length);
+
+    char chunk[65536];
+    size_t r;
+    while ((r = fread(chunk, 1, sizeof(chunk), stream)) > 0) {
+        fwrite(chunk, 1, r, buffer);
+    }
+    fclose(buffer);
+
+    return data;
+}
+
+static int send_request(int fd, char* request, size_t length) {
+    size_t response_length;
+    char* response;
+    if (!write_frame(fd, request, length) ||
+        (response = read_frame(fd, &response_length)) == NULL ||
+        response_length == 0) {
+        fprintf(stderr, "failed to communicate with the server\n");
+        return -1;
+    }
+
+    int status = response[0];
+    fwrite(response + 1, 1, response_length - 1, (status == STATUS_OK) ? stdout : stderr);
+    fputc('\n', (status == STATUS_OK) ? stdout : stderr);
+    free(response);
+
+    return status;
+}
+
+int run_client(char* path, int num_expressions, char** expressions) {
+    struct sockaddr_un address;
+    int fd = open_socket(path, &address);
+    if (fd == -1) {
+        return 1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+
+    // the expressions are sent over the same connection,
+    // or the whole stdin as one if there are none
+    int status = 0;
+    if (num_expressions == 0) {
+        size_t length;
+        char* request = read_stream(stdin, &length);
+        int s = send_request(fd, request, length);
+        free(request);
+        status = (s != STATUS_OK);
+    } else {
+        for (int i = 0; i < num_expressions; i++) {
+            int s = send_request(fd, expressions[i], strlen(expressions[i]));
+            if (s == -1) {
+                status = 1;
+                break;
+            } else if (s != STATUS_OK) {
+                status = 1;
+            }
+        }
+    }
+
+    close(fd);
+
+    return status;
+}
@@ -0,0 +1,22 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <stddef.h>
+
+#include "env.h"
+
+// the frames are 4-byte big-endian lengths followed by the
+// payload: an expression in requests and a status byte (0 if
+// the result is not an error) followed by the result in responses
+
+#define SERVER_MAX_FRAME_SIZE (64 * 1024 * 1024)
+
+int write_frame(int fd, char* data, size_t length);
+char* read_frame(int fd, size_t* length);
+
+void serve_connection(environment* env, int fd);
+
+int run_server(char* image, char* path, int num_files, char** files);
+int run_client(char* path, int num_expressions, char** expressions);
+
+#endif  // SERVER_H_
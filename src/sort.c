@@ -0,0 +1,199 @@
+#include "sort.h"
+
+#include <string.h>
+
+#include "value.h"
+
+// the shorter ranges are sorted by insertion
+#define INSERTION_SORT_LENGTH 16
+
+// the comparisons may be inconsistent (e.g., a lambda returning
+// random truths, or the NaNs equal to any number), so the loops
+// below never rely on them to stay within the ranges: the order
+// is unspecified then, but the items are all kept
+
+static void swap(value** items, size_t i, size_t j) {
+    value* temp = items[i];
+    items[i] = items[j];
+    items[j] = temp;
+}
+
+// stable: an item is moved only before the ones it goes before
+static void insertion_sort(value** items, size_t length, sort_less less, void* context) {
+    for (size_t i = 1; i < length; i++) {
+        value* item = items[i];
+        size_t j = i;
+        for (; j > 0 && less(item, items[j - 1], context); j--) {
+            items[j] = items[j - 1];
+        }
+        items[j] = item;
+    }
+}
+
+static void sift_down(value** items, size_t root, size_t length, sort_less less, void* context) {
+    value* item = items[root];
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= length) {
+            break;
+        } else if (child + 1 < length && less(items[child], items[child + 1], context)) {
+            child++;
+        }
+
+        if (!less(item, items[child], context)) {
+            break;
+        }
+        items[root] = items[child];
+        root = child;
+    }
+    items[root] = item;
+}
+
+static void heap_sort(value** items, size_t length, sort_less less, void* context) {
+    for (size_t i = length / 2; i-- > 0;) {
+        sift_down(items, i, length, less, context);
+    }
+    for (size_t end = length - 1; end > 0; end--) {
+        swap(items, 0, end);
+        sift_down(items, 0, end, less, context);
+    }
+}
+
+// the median of the first, middle and last items is the pivot,
+// and the items equal to it stop both scans, so the runs of equal
+// items are split in halves instead of degrading to n^2
+static size_t partition(value** items, size_t length, sort_less less, void* context) {
+    size_t middle = length / 2;
+    size_t last = length - 1;
+    if (less(items[middle], items[0], context)) {
+        swap(items, 0, middle);
+    }
+    if (less(items[last], items[middle], context)) {
+        swap(items, middle, last);
+        if (less(items[middle], items[0], context)) {
+            swap(items, 0, middle);
+        }
+    }
+    swap(items, 0, middle);
+
+    value* pivot = items[0];
+    size_t i = 0;
+    size_t j = length;
+    for (;;) {
+        do {
+            i++;
+        } while (i < length && less(items[i], pivot, context));
+        do {
+            j--;
+        } while (j > 0 && less(pivot, items[j], context));
+
+        if (i >= j) {
+            break;
+        }
+        swap(items, i, j);
+    }
+    swap(items, 0, j);
+
+    return j;
+}
+
+// introsort: quicksort falling back to heapsort past 2 log n
+// levels of bad pivots, and to insertion sort on short ranges
+static void intro_sort(value** items, size_t length, size_t depth, sort_less less, void* context) {
+    while (length > INSERTION_SORT_LENGTH) {
+        if (depth == 0) {
+            heap_sort(items, length, less, context);
+            return;
+        }
+        depth--;
+
+        // the shorter side is recursed into, and the
+        // longer one is looped on, to bound the stack
+        size_t pivot = partition(items, length, less, context);
+        if (pivot < length - pivot) {
+            intro_sort(items, pivot, depth, less, context);
+            items += pivot + 1;
+            length -= pivot + 1;
+        } else {
+            intro_sort(items + pivot + 1, length - pivot - 1, depth, less, context);
+            length = pivot;
+        }
+    }
+
+    insertion_sort(items, length, less, context);
+}
+
+void sort_values(value** items, size_t length, sort_less less, void* context) {
+    size_t depth = 0;
+    for (size_t n = length; n > 1; n /= 2) {
+        depth += 2;
+    }
+
+    intro_sort(items, length, depth, less, context);
+}
+
+// the buffer holds at least length / 2 items
+void sort_values_stable(value** items, value** buffer, size_t length, sort_less less, void* context) {
+    if (length <= INSERTION_SORT_LENGTH) {
+        insertion_sort(items, length, less, context);
+        return;
+    }
+
+    size_t middle = length / 2;
+    sort_values_stable(items, buffer, middle, less, context);
+    sort_values_stable(items + middle, buffer, length - middle, less, context);
+
+    if (!less(items[middle], items[middle - 1], context)) {
+        // the halves are in order already (e.g., the input was sorted)
+        return;
+    }
+
+    // merged from the left half moved aside, the items
+    // are never written before the right half is read
+    memcpy(buffer, items, middle * sizeof(value*));
+    sort_merge(buffer, middle, items + middle, length - middle, items, less, context);
+}
+
+// stable: the equal items are taken from the left first
+void sort_merge(
+    value** left, size_t left_length,
+    value** right, size_t right_length,
+    value** out, sort_less less, void* context) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < left_length && j < right_length) {
+        if (less(right[j], left[i], context)) {
+            *out++ = right[j++];
+        } else {
+            *out++ = left[i++];
+        }
+    }
+
+    // the rest of the right items may be in place already
+    memmove(out, left + i, (left_length - i) * sizeof(value*));
+    out += left_length - i;
+    if (out != right + j) {
+        memmove(out, right + j, (right_length - j) * sizeof(value*));
+    }
+}
+
+// the merge path: the number of left items among the first
+// diagonal items of the merge, found by binary search, so
+// the merge can be split in independent pieces
+size_t sort_split(
+    value** left, size_t left_length,
+    value** right, size_t right_length,
+    size_t diagonal, sort_less less, void* context) {
+    size_t low = (diagonal > right_length) ? diagonal - right_length : 0;
+    size_t high = (diagonal < left_length) ? diagonal : left_length;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (less(right[diagonal - middle - 1], left[middle], context)) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    return low;
+}
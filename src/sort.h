@@ -0,0 +1,23 @@
+#ifndef SORT_H_
+#define SORT_H_
+
+#include <stddef.h>
+
+#include "value.h"
+
+// tells if the first value goes strictly before the second one
+typedef int (*sort_less)(value* v1, value* v2, void* context);
+
+void sort_values(value** items, size_t length, sort_less less, void* context);
+void sort_values_stable(value** items, value** buffer, size_t length, sort_less less, void* context);
+
+void sort_merge(
+    value** left, size_t left_length,
+    value** right, size_t right_length,
+    value** out, sort_less less, void* context);
+size_t sort_split(
+    value** left, size_t left_length,
+    value** right, size_t right_length,
+    size_t diagonal, sort_less less, void* context);
+
+#endif  // SORT_H_
@@ -1,45 +1,96 @@
 #include "test.h"
 
-#include <assert.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "cache.h"
 #include "env.h"
 #include "eval.h"
+#include "image.h"
+#include "mylisp.h"
 #include "parse.h"
+#include "pool.h"
+#include "script.h"
+#include "server.h"
 #include "value.h"
 
-#define RUN_TEST_FN(fn)                        \
-    {                                          \
-        printf("[%s]\n", #fn);                 \
-        printf("=========================\n"); \
-        environment env;                       \
-        environment_init(&env);                \
-        environment_register_builtins(&env);   \
-        fn(&env);                              \
-        environment_dispose(&env);             \
-        printf("\n");                          \
-    }
+// the state of a group's cases, which the environments of
+// the group (and of the interpreters it starts) point to
+typedef struct test_state {
+    int num_cases;
+    int num_failures;
+    double budget;
+} test_state;
+
+static void test_state_init(test_state* state, double budget) {
+    state->num_cases = 0;
+    state->num_failures = 0;
+    state->budget = budget;
+}
+
+static double get_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-static int counter = 0;
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+// the cases are numbered per context, for the
+// tests of different interpreters not to interfere
+static int next_case_number(environment* env) {
+    test_state* state = environment_get_context(env)->userdata;
+    return ++state->num_cases;
+}
+
+static void report_failure(environment* env, char* check, int line) {
+    test_state* state = environment_get_context(env)->userdata;
+    state->num_failures++;
+
+    fprintf(
+        environment_get_context(env)->output,
+        "\x1B[31mFAILED: %s (line %d)\x1B[0m\n",
+        check, line);
+}
+
+// a failed check is reported in the output of its group,
+// and the remaining cases of the group are still run
+#define TEST_CHECK(env, condition)                       \
+    do {                                                 \
+        if (!(condition)) {                              \
+            report_failure((env), #condition, __LINE__); \
+        }                                                \
+    } while (0)
 
 static value* get_evaluated(environment* env, char* input) {
     char output[1024];
 
+    double start = get_time_ms();
     value* v = value_parse(input);
     if (v->type != VALUE_ERROR) {
         value* e = value_evaluate(v, env);
         value_dispose(v);
         v = e;
     }
+    double time = get_time_ms() - start;
 
     value_to_str(v, output);
-    printf(
+    fprintf(
+        environment_get_context(env)->output,
         "\x1B[34m%-5d\x1B[0m "
         "\x1B[34m[\x1B[0m%s\x1B[34m]\x1B[0m "
         "\x1B[34m-->\x1B[0m "
-        "\x1B[34m[\x1B[0m%s\x1B[34m]\x1B[0m\n",
-        ++counter, input, output);
+        "\x1B[34m[\x1B[0m%s\x1B[34m]\x1B[0m "
+        "\x1B[90m%.3f ms\x1B[0m\n",
+        next_case_number(env), input, output, time);
+
+    test_state* state = environment_get_context(env)->userdata;
+    TEST_CHECK(env, state->budget == 0 || time <= state->budget);
 
     return v;
 }
@@ -48,8 +99,18 @@ static void test_number_output(environment* env, char* input, double expected) {
     value* e = get_evaluated(env, input);
 
     if (e != NULL) {
-        assert(e->type == VALUE_NUMBER);
-        assert(e->number == expected);
+        TEST_CHECK(env, value_is_number(e));
+        TEST_CHECK(env, e->number == expected);
+        value_dispose(e);
+    }
+}
+
+static void test_integer_output(environment* env, char* input, int64_t expected) {
+    value* e = get_evaluated(env, input);
+
+    if (e != NULL) {
+        TEST_CHECK(env, e->type == VALUE_INTEGER);
+        TEST_CHECK(env, e->integer == expected);
         value_dispose(e);
     }
 }
@@ -58,8 +119,7 @@ static void test_error_output(environment* env, char* input, char* expected) {
     value* e = get_evaluated(env, input);
 
     if (e != NULL) {
-        assert(e->type == VALUE_ERROR);
-        assert(strstr(e->symbol, expected));
+        TEST_CHECK(env, e->type == VALUE_ERROR && strstr(e->symbol, expected));
         value_dispose(e);
     }
 }
@@ -68,8 +128,7 @@ static void test_info_output(environment* env, char* input, char* expected) {
     value* e = get_evaluated(env, input);
 
     if (e != NULL) {
-        assert(e->type == VALUE_INFO);
-        assert(strstr(e->symbol, expected));
+        TEST_CHECK(env, e->type == VALUE_INFO && strstr(e->symbol, expected));
         value_dispose(e);
     }
 }
@@ -78,8 +137,8 @@ static void test_bool_output(environment* env, char* input, int expected) {
     value* e = get_evaluated(env, input);
 
     if (e != NULL) {
-        assert(e->type == VALUE_BOOL);
-        assert(e->number == expected);
+        TEST_CHECK(env, e->type == VALUE_BOOL);
+        TEST_CHECK(env, e->number == expected);
         value_dispose(e);
     }
 }
@@ -90,11 +149,67 @@ static void test_full_output(environment* env, char* input, char* expected) {
     if (e != NULL) {
         char buffer[1024];
         value_to_str(e, buffer);
-        assert(strcmp(buffer, expected) == 0);
+        TEST_CHECK(env, strcmp(buffer, expected) == 0);
         value_dispose(e);
     }
 }
 
+static void test_print_output(environment* env, char* input, char* expected) {
+    value* e = get_evaluated(env, input);
+
+    if (e != NULL) {
+        char* buffer = NULL;
+        size_t length = 0;
+        FILE* stream = open_memstream(&buffer, &length);
+        value_print(e, stream);
+        fclose(stream);
+        TEST_CHECK(env, strcmp(buffer, expected) == 0);
+        free(buffer);
+        value_dispose(e);
+    }
+}
+
+// the binding of the name in the global frame, or NULL
+static binding* get_global_binding(environment* env, char* name) {
+    while (env->parent != NULL) {
+        env = env->parent;
+    }
+    for (size_t i = 0; i < env->length; i++) {
+        if (strcmp(env->bindings[i]->name, name) == 0) {
+            return env->bindings[i];
+        }
+    }
+
+    return NULL;
+}
+
+// the count is read atomically, as the pool threads update it
+static size_t get_binding_refs(binding* b) {
+    return __sync_add_and_fetch(&b->num_refs, 0);
+}
+
+// a snapshot shares the global bindings (and so the bound values)
+// instead of copying them, and the snapshots taken by the input
+// release them once it's evaluated
+static void test_snapshots_share_globals(environment* env, char* input) {
+    value_dispose(get_evaluated(env, "def {shared-global} {1 2 3}"));
+    binding* b = get_global_binding(env, "shared-global");
+    value* v = b->value;
+
+    environment snapshot;
+    environment_snapshot(&snapshot, env);
+    TEST_CHECK(env, get_global_binding(&snapshot, "shared-global") == b);
+    TEST_CHECK(env, get_binding_refs(b) == 2);
+
+    value_dispose(get_evaluated(env, input));
+    TEST_CHECK(env, get_binding_refs(b) == 2);
+    environment_dispose(&snapshot);
+    TEST_CHECK(env, get_binding_refs(b) == 1);
+    TEST_CHECK(env, get_global_binding(env, "shared-global") == b && b->value == v);
+
+    value_dispose(get_evaluated(env, "del {shared-global}"));
+}
+
 static void test_parsing(environment* env) {
     test_number_output(env, "1", 1);
     test_number_output(env, ".14", 0.14);
@@ -104,6 +219,15 @@ static void test_parsing(environment* env) {
     test_number_output(env, "3.14E+1", 31.4);
     test_number_output(env, "+3.14E-1", 0.314);
     test_number_output(env, "-3.14e-1", -0.314);
+    test_number_output(env, "0.1", 0.1);
+    test_number_output(env, "-0.000123", -0.000123);
+    test_number_output(env, "9007199254740993", 9007199254740993.0);
+    test_number_output(env, "123456789012345678901234567890", 123456789012345678901234567890.0);
+    test_number_output(env, "2.2250738585072014e-308", 2.2250738585072014e-308);
+    test_number_output(env, "1.7976931348623157e308", 1.7976931348623157e308);
+    test_number_output(env, "0.30000000000000004", 0.30000000000000004);
+    test_number_output(env, "1e22", 1e22);
+    test_number_output(env, "1e23", 1e23);
     test_bool_output(env, "#true", 1);
     test_bool_output(env, "#false", 0);
     test_full_output(env, "#null", "{}");
@@ -124,6 +248,9 @@ static void test_parsing(environment* env) {
     test_error_output(env, "3.14e5+", "undefined symbol: 3.14e5+");
     test_error_output(env, "3.14e1.2", "undefined symbol: 3.14e1.2");
     test_error_output(env, ".", "undefined symbol: .");
+    test_error_output(env, "1e", "undefined symbol: 1e");
+    test_error_output(env, "+.e1", "undefined symbol: +.e1");
+    test_error_output(env, "1e400", "parsing error at 1: malformed number: 1e400");
     test_error_output(env, "\"abc", "parsing error at 1: unterminated string");
     test_error_output(env, "(+ 1 2 3", "parsing error at 9: missing ')'");
     test_error_output(env, "{(+ 1 2 3) 4", "parsing error at 13: missing '}'");
@@ -132,6 +259,49 @@ static void test_parsing(environment* env) {
     test_error_output(env, "$", "parsing error at 1: unexpected symbol '$'");
 }
 
+static void test_parse_parallel_equal(environment* env, char* input, size_t num_threads) {
+    value* sequential = value_parse(input);
+    value* parallel = value_parse_parallel(input, num_threads);
+
+    if (sequential->type == VALUE_ERROR) {
+        TEST_CHECK(env, parallel->type == VALUE_ERROR && strcmp(sequential->symbol, parallel->symbol) == 0);
+    } else {
+        value* equal = value_equals(sequential, parallel);
+        TEST_CHECK(env, equal->type == VALUE_BOOL && equal->number == 1);
+        value_dispose(equal);
+    }
+
+    value_dispose(sequential);
+    value_dispose(parallel);
+}
+
+static void test_parse_parallel(environment* env) {
+    size_t num_forms = 20000;
+    char* input = malloc(num_forms * 64 + 64);
+    char* running = input;
+    for (size_t i = 0; i < num_forms; i++) {
+        running += sprintf(running, "(def {x%zu} {%zu \"s(%zu}\" ; c)\n}) ", i, i, i);
+    }
+
+    test_parse_parallel_equal(env, "", 4);
+    test_parse_parallel_equal(env, "1 2 3", 4);
+    test_parse_parallel_equal(env, input, 1);
+    test_parse_parallel_equal(env, input, 4);
+    test_parse_parallel_equal(env, input, 16);
+    fprintf(environment_get_context(env)->output, "parsed %zu forms on 1, 4 and 16 threads\n", num_forms);
+
+    // an error in the middle of the input
+    input[strlen(input) / 2] = '$';
+    test_parse_parallel_equal(env, input, 4);
+
+    // an error at the very end
+    sprintf(input + strlen(input), "(+ 1");
+    test_parse_parallel_equal(env, input, 4);
+    fprintf(environment_get_context(env)->output, "reported the same errors on 4 threads\n");
+
+    free(input);
+}
+
 static void test_numeric(environment* env) {
     test_number_output(env, "+ 1", 1);
     test_number_output(env, "+ -1", -1);
@@ -147,7 +317,7 @@ static void test_numeric(environment* env) {
     test_number_output(env, "/ 1 2", 0.5);
     test_number_output(env, "/ -3 4", -0.75);
     test_number_output(env, "% 11 3", 2);
-    test_number_output(env, "% 11.5 3.2", 2);
+    test_number_output(env, "% 11.5 3.2", fmod(11.5, 3.2));
     test_number_output(env, "^ 2 10", 1024);
     test_number_output(env, "^ 2 -10", 1. / 1024);
     test_number_output(env, "+ 1 (* 2 3) 4 (/ 10 5) (- 6 (% 8 7)) 9", 27);
@@ -163,6 +333,64 @@ static void test_numeric(environment* env) {
     test_number_output(env, "(+ 1 2 3 (- 4 5) 6)", 11);
 }
 
+static void test_integer(environment* env) {
+    test_integer_output(env, "42", 42);
+    test_integer_output(env, "-42", -42);
+    test_integer_output(env, "+ 1 2 3", 6);
+    test_integer_output(env, "- 1 2 3", -4);
+    test_integer_output(env, "- 7", -7);
+    test_integer_output(env, "* 1 2 3 4 5", 120);
+    test_integer_output(env, "/ 12 4", 3);
+    test_integer_output(env, "% -7 3", -1);
+    test_integer_output(env, "min 3 1 2", 1);
+    test_integer_output(env, "max 3 1 2", 3);
+    test_integer_output(env, "len {1 2 3}", 3);
+    test_integer_output(env, "slen \"abc\"", 3);
+
+    // beyond the range of exactly representable doubles
+    test_integer_output(env, "9007199254740993", 9007199254740993LL);
+    test_integer_output(env, "+ 9007199254740992 1", 9007199254740993LL);
+    test_full_output(env, "9223372036854775807", "9223372036854775807");
+    test_full_output(env, "- 9223372036854775807 1", "9223372036854775806");
+    test_bool_output(env, "== 9007199254740993 9007199254740992", 0);
+    test_bool_output(env, "> 9007199254740993 9007199254740992", 1);
+
+    // inexact results and mixed operands are promoted to double
+    test_number_output(env, "/ 7 2", 3.5);
+    test_number_output(env, "+ 1 2.5", 3.5);
+    test_number_output(env, "* 2 0.5", 1);
+    test_number_output(env, "^ 2 3", 8);
+    test_number_output(env, "+ 9223372036854775807 1", 9223372036854775808.0);
+    test_number_output(env, "* 4611686018427387904 4", 18446744073709551616.0);
+    test_number_output(env, "- -9223372036854775807 2", -9223372036854775809.0);
+    test_number_output(env, "99999999999999999999", 1e20);
+    test_number_output(env, "1e3", 1000);
+    test_number_output(env, "2.0", 2);
+    test_full_output(env, "/ 7 2", "3.5");
+
+    // equal values compare equal regardless of representation
+    test_bool_output(env, "== 2 2.0", 1);
+    test_bool_output(env, "< 1 1.5", 1);
+    test_bool_output(env, "== {1 2} {1.0 2}", 1);
+
+    // and mixed integers and doubles are compared exactly
+    test_bool_output(env, "== 9007199254740993 9007199254740992.0", 0);
+    test_bool_output(env, "== 9007199254740992 9007199254740992.0", 1);
+    test_bool_output(env, "> 9007199254740993 9007199254740992.0", 1);
+    test_bool_output(env, "< 9007199254740992.0 9007199254740993", 1);
+    test_bool_output(env, "< 9223372036854775807 9223372036854775808.0", 1);
+    test_bool_output(env, "> -9223372036854775807 -9223372036854775808.0", 1);
+    test_bool_output(env, "< 9223372036854775807 (^ 10 400)", 1);
+    test_bool_output(env, "< 2 2.5", 1);
+    test_bool_output(env, "> -2 -2.5", 1);
+    test_bool_output(env, "== 0 -0.0", 1);
+    test_bool_output(env, "== 1 (- (^ 10 400) (^ 10 400))", 0);
+
+    test_error_output(env, "% 1 0", "division by zero");
+    test_error_output(env, "/ 9007199254740993 0", "division by zero");
+    test_error_output(env, "+ 1 \"a\"", "must be of type number, but got string");
+}
+
 static void test_errors(environment* env) {
     test_error_output(env, "/ 1 0", "division by zero");
     test_error_output(env, "+ 1 (/ 2 0) 3", "division by zero");
@@ -191,6 +419,35 @@ static void test_full(environment* env) {
     test_full_output(env, "{+ 1 2 3 (- 4 5) 6}", "{+ 1 2 3 (- 4 5) 6}");
 }
 
+static void test_print(environment* env) {
+    test_print_output(env, "", "()");
+    test_print_output(env, "+", "<builtin +>");
+    test_print_output(env, "-3.14", "-3.14");
+    test_print_output(env, "{1 2 {3 (4)} {}}", "{1 2 {3 (4)} {}}");
+    test_print_output(env, "\"a\\\"b\\n\"", "\"a\\\"b\\n\"");
+    test_print_output(env, "{#true #false}", "{#true #false}");
+    test_print_output(env, "lambda {x y} {+ x y}", "<lambda {x y} {+ x y}>");
+    test_print_output(env, "error \"e\"", "\x1B[31me\x1B[0m");
+
+    // longer than the fixed buffer of value_to_str
+    char input[4096] = "{";
+    for (int i = 0; i < 1000; i++) {
+        strcat(input, (i > 0) ? " 123" : "123");
+    }
+    strcat(input, "}");
+    value* v = value_parse(input);
+    value* e = value_evaluate(v, env);
+    char* buffer = NULL;
+    size_t length = 0;
+    FILE* stream = open_memstream(&buffer, &length);
+    value_print(e, stream);
+    fclose(stream);
+    TEST_CHECK(env, strcmp(buffer, input) == 0);
+    free(buffer);
+    value_dispose(e);
+    value_dispose(v);
+}
+
 static void test_special(environment* env) {
     test_bool_output(env, "#true", 1);
     test_bool_output(env, "#false", 0);
@@ -339,6 +596,187 @@ static void test_init(environment* env) {
     test_error_output(env, "init {1} {2}", "expects exactly 1 arg");
 }
 
+static void test_nth(environment* env) {
+    test_number_output(env, "nth {1 2 3} 0", 1);
+    test_number_output(env, "nth {1 2 3} 2", 3);
+    test_number_output(env, "nth {1 2 3} 2.0", 3);
+    test_full_output(env, "nth {{1} (+ 2 3) {4}} 1", "(+ 2 3)");
+    test_number_output(env, "nth (arange 10 20) 5", 15);
+
+    // the list is borrowed from the environment
+    test_info_output(env, "def {xs} (vlist (arange 1000))", "defined: xs");
+    test_info_output(env, "fn {sum-from i acc} {if (== i (len xs)) {acc} {sum-from (+ i 1) (+ acc (nth xs i))}}",
+                     "defined: sum-from");
+    test_number_output(env, "sum-from 0 0", 499500);
+    test_number_output(env, "nth xs (- (len xs) 1)", 999);
+    test_number_output(env, "(lambda {xs} {nth xs 1}) {5 6}", 6);
+    test_error_output(env, "nth ys 0", "undefined symbol: ys");
+
+    test_error_output(env, "nth {1 2 3} 3", "index 3 is out of the range of 3 items");
+    test_error_output(env, "nth {} 0", "index 0 is out of the range of 0 items");
+    test_error_output(env, "nth {1 2 3} -1", "arg #1 (-1) must be a non-negative integer");
+    test_error_output(env, "nth {1 2 3} 0.5", "arg #1 (0.5) must be a non-negative integer");
+    test_error_output(env, "nth {1 2 3} {0}", "arg #1 ({0}) must be of type number");
+    test_error_output(env, "nth 1 0", "arg #0 (1) must be of type q-expr");
+    test_error_output(env, "nth {1}", "expects exactly 2 args");
+}
+
+static void test_slice(environment* env) {
+    test_full_output(env, "slice {1 2 3 4 5} 1 3", "{2 3}");
+    test_full_output(env, "slice {1 2 3 4 5} 2", "{3 4 5}");
+    test_full_output(env, "slice {1 2 3 4 5} 0 5", "{1 2 3 4 5}");
+    test_full_output(env, "slice {1 2 3 4 5} 5", "{}");
+    test_full_output(env, "slice {1 2 3} 1 1", "{}");
+    test_full_output(env, "slice {{1} (+ 2 3) {4}} 1", "{(+ 2 3) {4}}");
+    test_full_output(env, "slice (arange 10) 7", "[7 8 9]");
+
+    test_error_output(env, "slice {1 2 3} 2 1", "slice [2, 1) is out of the range of 3 items");
+    test_error_output(env, "slice {1 2 3} 0 4", "out of the range of 3 items");
+    test_error_output(env, "slice {1 2 3} 4", "out of the range of 3 items");
+    test_error_output(env, "slice {1 2 3} -1", "arg #1 (-1) must be a non-negative integer");
+    test_error_output(env, "slice {1 2 3} 0 1.5", "arg #2 (1.5) must be a non-negative integer");
+    test_error_output(env, "slice \"abc\" 1", "arg #0 (\"abc\") must be of type q-expr");
+    test_error_output(env, "slice {1 2 3}", "expects at least 2 args");
+}
+
+static void test_take(environment* env) {
+    test_full_output(env, "take {1 2 3} 2", "{1 2}");
+    test_full_output(env, "take {1 2 3} 0", "{}");
+    test_full_output(env, "take {1 2 3} 5", "{1 2 3}");
+    test_full_output(env, "take {} 1", "{}");
+    test_full_output(env, "take (arange 5) 2", "[0 1]");
+
+    test_error_output(env, "take {1 2 3} -1", "arg #1 (-1) must be a non-negative integer");
+    test_error_output(env, "take 1 1", "arg #0 (1) must be of type q-expr");
+}
+
+static void test_drop(environment* env) {
+    test_full_output(env, "drop {1 2 3} 2", "{3}");
+    test_full_output(env, "drop {1 2 3} 0", "{1 2 3}");
+    test_full_output(env, "drop {1 2 3} 5", "{}");
+    test_full_output(env, "drop {} 1", "{}");
+    test_full_output(env, "drop (arange 5) 2", "[2 3 4]");
+
+    test_error_output(env, "drop {1 2 3} 0.5", "arg #1 (0.5) must be a non-negative integer");
+    test_error_output(env, "drop 1 1", "arg #0 (1) must be of type q-expr");
+}
+
+static void test_map(environment* env) {
+    test_full_output(env, "map (lambda {x} {* x x}) {1 2 3}", "{1 4 9}");
+    test_full_output(env, "map head {{1 2} {3} {{4}}}", "{{1} {3} {{4}}}");
+    test_full_output(env, "map - {1 -2 3}", "{-1 2 -3}");
+    test_full_output(env, "map (lambda {x} {x}) {}", "{}");
+    test_full_output(env, "map (lambda {x} {map (lambda {y} {* x y}) {1 2}}) {1 2}", "{{1 2} {2 4}}");
+    test_info_output(env, "def {k} 10", "defined: k");
+    test_full_output(env, "map (lambda {x} {+ x k}) {1 2}", "{11 12}");
+
+    test_error_output(env, "map (lambda {x} {if (== x 2) {error \"two\"} {x}}) {1 2 3}", "two");
+    test_error_output(env, "map head {{1} 2}", "head: arg #0 (2) must be of type q-expr");
+    test_error_output(env, "map (lambda {x y} {x}) {1}", "expects exactly 2 args");
+    test_error_output(env, "map 1 {1}", "arg #0 (1) must be of type function");
+    test_error_output(env, "map head 1", "arg #1 (1) must be of type q-expr");
+}
+
+static void test_filter(environment* env) {
+    test_full_output(env, "filter (lambda {x} {> x 1}) {1 2 3}", "{2 3}");
+    test_full_output(env, "filter (lambda {x} {x}) {1 0 2 {} {3}}", "{1 2 {3}}");
+    test_full_output(env, "filter list? {1 {2} (3) {}}", "{{2} {}}");
+    test_full_output(env, "filter (lambda {x} {#false}) {1 2 3}", "{}");
+    test_full_output(env, "filter (lambda {x} {#true}) {}", "{}");
+
+    test_error_output(env, "filter (lambda {x} {+}) {1}", "can't cast function to bool");
+    test_error_output(env, "filter (lambda {x} {error \"no\"}) {1}", "no");
+    test_error_output(env, "filter 1 {1}", "arg #0 (1) must be of type function");
+}
+
+static void test_foldl(environment* env) {
+    test_number_output(env, "foldl + 0 {1 2 3}", 6);
+    test_number_output(env, "foldl - 0 {1 2 3}", -6);
+    test_number_output(env, "foldl * 1 {1 2 3 4}", 24);
+    test_number_output(env, "foldl max 0 {3 7 2}", 7);
+    test_number_output(env, "foldl + 0 {1 2.5}", 3.5);
+    test_number_output(env, "foldl + 0 {}", 0);
+    test_full_output(env, "foldl + 9223372036854775807 {1}", "9.22337e+18");
+    test_full_output(env, "foldl join {} {{1} {2 3} {}}", "{1 2 3}");
+    test_full_output(env, "foldl (lambda {acc x} {cons x acc}) {} {1 2 3}", "{3 2 1}");
+    test_full_output(env, "foldl + {} {}", "{}");
+
+    test_error_output(env, "foldl + 0 {1 {2}}", "+: arg #1 ({2}) must be of type number");
+    test_error_output(env, "foldl (lambda {acc x} {error \"no\"}) 0 {1}", "no");
+    test_error_output(env, "foldl + 0 1", "arg #2 (1) must be of type q-expr");
+    test_error_output(env, "foldl + {1}", "expects exactly 3 args");
+}
+
+static void test_foldr(environment* env) {
+    test_number_output(env, "foldr + 0 {1 2 3}", 6);
+    test_number_output(env, "foldr - 0 {1 2 3}", 2);
+    test_full_output(env, "foldr cons {} {1 2 3}", "{1 2 3}");
+    test_full_output(env, "foldr (lambda {x acc} {join acc (cons x {})}) {} {1 2 3}", "{3 2 1}");
+    test_number_output(env, "foldr min 10 {}", 10);
+
+    // the native folding of the numbers goes from the last one on too
+    test_number_output(env, "foldr + 0 {1 10000000000000000.0 -10000000000000000.0}", 1);
+    test_number_output(env, "foldl + 0 {1 10000000000000000.0 -10000000000000000.0}", 0);
+    test_integer_output(env, "foldr + 0 {9223372036854775807 1 -1}", 9223372036854775807LL);
+    test_full_output(env, "foldl + 0 {9223372036854775807 1 -1}", "9.22337e+18");
+
+    test_error_output(env, "foldr cons 1 {1}", "arg #1 (1) must be of type q-expr");
+    test_error_output(env, "foldr 1 0 {}", "arg #0 (1) must be of type function");
+}
+
+static void test_sort(environment* env) {
+    test_full_output(env, "sort {3 1 2}", "{1 2 3}");
+    test_full_output(env, "sort {}", "{}");
+    test_full_output(env, "sort {1}", "{1}");
+    test_full_output(env, "sort {2 1.5 -3 1}", "{-3 1 1.5 2}");
+    test_full_output(env, "sort {\"b\" \"c\" \"a\"}", "{\"a\" \"b\" \"c\"}");
+    test_full_output(env, "sort {{2 1} {1 3} {1} {2}}", "{{1} {1 3} {2} {2 1}}");
+    test_full_output(env, "sort < {3 1 2}", "{1 2 3}");
+    test_full_output(env, "sort > {3 1 2}", "{3 2 1}");
+    test_full_output(env, "sort (lambda {a b} {> a b}) {3 1 2}", "{3 2 1}");
+    test_full_output(env, "sort (lambda {a b} {< (len a) (len b)}) {{1 2 3} {} {1}}", "{{} {1} {1 2 3}}");
+    test_full_output(env, "sort {5 1 4 1 5 9 2 6 5 3 5 8 9 7 9 3 2 3 8 4 6 2 6 4 3}",
+                     "{1 1 2 2 2 3 3 3 3 4 4 4 5 5 5 5 6 6 6 7 8 8 9 9 9}");
+    test_full_output(env, "take (sort (vlist (arange 100 0 -1))) 3", "{1 2 3}");
+    test_full_output(env, "take (sort (map (lambda {x} {% (* x 37) 101}) (vlist (arange 101)))) 3", "{0 1 2}");
+    test_full_output(env, "take (sort (map (lambda {x} {% x 2}) (vlist (arange 1000)))) 3", "{0 0 0}");
+    test_full_output(env, "take (sort > (map (lambda {x} {% (* x 7919) 10007}) (vlist (arange 10007)))) 3", "{10006 10005 10004}");
+    test_info_output(env, "def {xs} {3 1 2}", "defined: xs");
+    test_full_output(env, "sort xs", "{1 2 3}");
+    test_full_output(env, "xs", "{3 1 2}");
+
+    // the pieces of a parallel sort by a lambda share the bound values
+    test_info_output(env, "def {ys} (map (lambda {x} {% (* x 7919) 10007}) (vlist (arange 5000)))", "defined: ys");
+    test_snapshots_share_globals(env, "take (sort (lambda {a b} {< a b}) ys) 3");
+
+    test_error_output(env, "sort {1 \"a\"}", "can't compare values of different types: string and integer");
+    test_error_output(env, "sort {#true #false}", "incomprable type: bool");
+    test_error_output(env, "sort (lambda {a b} {error \"no\"}) {1 2}", "no");
+    test_error_output(env, "sort (lambda {a b} {+}) {1 2}", "can't cast function to bool");
+    test_error_output(env, "sort 1 {1 2}", "arg #0 (1) must be of type function");
+    test_error_output(env, "sort 1", "arg #0 (1) must be of type q-expr");
+    test_error_output(env, "sort < 1", "arg #1 (1) must be of type q-expr");
+    test_error_output(env, "sort < {1} {2}", "expects at most 2 args");
+}
+
+static void test_stable_sort(environment* env) {
+    test_full_output(env, "stable-sort {3 1 2}", "{1 2 3}");
+    test_full_output(env, "stable-sort {}", "{}");
+    test_full_output(env, "stable-sort > {3 1 2}", "{3 2 1}");
+    test_full_output(env, "stable-sort (lambda {a b} {< (head a) (head b)}) {{2 1} {1 2} {2 3} {1 4}}",
+                     "{{1 2} {1 4} {2 1} {2 3}}");
+    test_full_output(env, "stable-sort (lambda {a b} {> (len a) (len b)}) {{1} {2 2} {3} {4 4}}",
+                     "{{2 2} {4 4} {1} {3}}");
+    test_info_output(env, "def {ps} (map (lambda {x} {cons (% (* x 37) 7) (cons x {})}) (vlist (arange 100)))", "defined: ps");
+    test_bool_output(env, "== (stable-sort (lambda {a b} {< (head a) (head b)}) ps) (sort ps)", 1);
+    test_info_output(env, "def {ps} (map (lambda {x} {cons (% (* x 37) 7) (cons x {})}) (vlist (arange 5000)))", "defined: ps");
+    test_bool_output(env, "== (stable-sort (lambda {a b} {< (head a) (head b)}) ps) (sort ps)", 1);
+
+    test_error_output(env, "stable-sort {1 {1}}", "can't compare values of different types");
+    test_error_output(env, "stable-sort (lambda {a b} {error \"no\"}) {1 2}", "no");
+    test_error_output(env, "stable-sort 1", "arg #0 (1) must be of type q-expr");
+}
+
 static void test_def(environment* env) {
     test_error_output(env, "two", "undefined symbol");
     test_info_output(env, "def {two} 2", "defined: two");
@@ -497,6 +935,23 @@ static void test_del(environment* env) {
     test_full_output(env, "+", "<builtin +>");
     test_info_output(env, "del {+}", "deleted: +");
     test_error_output(env, "+", "undefined symbol: +");
+    test_error_output(env, "del {+}", "not found: +");
+    test_number_output(env, "add 1 2", 3);
+    test_info_output(env, "def {+} -", "defined: +");
+    test_number_output(env, "+ 1 2", -1);
+    test_info_output(env, "del {+}", "deleted: +");
+    test_error_output(env, "+", "undefined symbol: +");
+    test_info_output(env, "def {min} max", "defined: min");
+    test_number_output(env, "min 1 2", 2);
+    test_info_output(env, "del {min}", "deleted: min");
+    test_error_output(env, "min", "undefined symbol: min");
+
+    char listing[16384];
+    environment_to_str(env, listing);
+    TEST_CHECK(env, strstr(listing, "<builtin add>") != NULL);
+    TEST_CHECK(env, strstr(listing, "<builtin max>") != NULL);
+    TEST_CHECK(env, strstr(listing, "<builtin +>") == NULL);
+    TEST_CHECK(env, strstr(listing, "<builtin min>") == NULL);
 
     test_error_output(env, "xyz", "undefined symbol: xyz");
     test_info_output(env, "def {xyz} 123", "defined: xyz");
@@ -970,12 +1425,843 @@ static void test_load(environment* env) {
     test_number_output(env, "f-sum {1 2 3}", 6);
     test_number_output(env, "f-last {1 2 3 4 5}", 5);
 
+    test_info_output(env, "load \"lib/forms.txt\"", "evaluated 8 expressions");
+    test_full_output(env, "semi", "\"; not a comment\"");
+    test_full_output(env, "quote", "\"escaped \\\" quote (\"");
+    test_full_output(env, "f-nested 1", "{1 \"}\"}");
+
+    // the second loads are served from the cache
+    test_info_output(env, "load \"lib/test.txt\"", "evaluated 4 expressions");
+    test_number_output(env, "f-sum {1 -2.5 3e10}", 1 - 2.5 + 3e10);
+    test_info_output(env, "load \"lib/forms.txt\"", "evaluated 8 expressions");
+    test_full_output(env, "quote", "\"escaped \\\" quote (\"");
+    test_full_output(env, "f-nested 1", "{1 \"}\"}");
+
+    // the cache is written by the first load and read by the next
+    // one: a cache rewritten with another form proves it's read
+    FILE* source = fopen("lib/cached.txt", "w");
+    fputs("(def {cached} 1)\n", source);
+    fclose(source);
+    remove("lib/cached.txt.cache");
+    test_info_output(env, "load \"lib/cached.txt\"", "evaluated 1 expression");
+    test_number_output(env, "cached", 1);
+    TEST_CHECK(env, access("lib/cached.txt.cache", R_OK) == 0);
+
+    cache c;
+    TEST_CHECK(env, cache_create(&c, "lib/cached.txt"));
+    value* form = value_parse("def {cached} 2");
+    cache_add(&c, form);
+    value_dispose(form);
+    cache_commit(&c);
+    test_info_output(env, "load \"lib/cached.txt\"", "evaluated 1 expression");
+    test_number_output(env, "cached", 2);
+
+    // a touched source invalidates the cache
+    source = fopen("lib/cached.txt", "w");
+    fputs("(def {cached} 3)\n\n", source);
+    fclose(source);
+    test_info_output(env, "load \"lib/cached.txt\"", "evaluated 1 expression");
+    test_number_output(env, "cached", 3);
+    remove("lib/cached.txt");
+    remove("lib/cached.txt.cache");
+
+    // a 0xFF byte isn't mistaken for the end of the file
+    source = fopen("lib/binary.txt", "w");
+    fputs("(def {binary} \"a\xff" "b\")\n(def {after} 1)\n", source);
+    fclose(source);
+    test_info_output(env, "load \"lib/binary.txt\"", "evaluated 2 expressions");
+    test_full_output(env, "binary", "\"a\xff" "b\"");
+    test_number_output(env, "after", 1);
+    remove("lib/binary.txt");
+    remove("lib/binary.txt.cache");
+
     test_error_output(env, "load 1", "arg #0 (1) must be of type string");
     test_error_output(env, "load \"file.txt\" 1", "expects exactly 1 arg");
     test_error_output(env, "load \"nonexistent.txt\"", "failed to open file");
     test_error_output(env, "load \"lib/malformed.txt\"", "parsing error");
 }
 
+static void test_dump(environment* env) {
+    test_info_output(env, "def {x} 5", "defined: x");
+    test_info_output(env, "def {xs} {1 -2.5 \"s\" {#true}}", "defined: xs");
+    test_info_output(env, "def {big} -9007199254740993", "defined: big");
+    test_info_output(env, "def {ys} (v/ (arange 5) 4)", "defined: ys");
+    test_info_output(env, "def {zs} (hput (hmap {{a {1 2}}}) \"b\" (arange 2))", "defined: zs");
+    test_info_output(env, "fn {sq x} {* x x}", "defined: sq");
+    test_info_output(env, "def {plus} +", "defined: plus");
+    test_info_output(env, "def {both} (lambda {a b} {and a b})", "defined: both");
+    test_info_output(env, "del {max}", "deleted: max");
+    test_info_output(env, "dump \"lib/test.image\"", "dumped image");
+
+    // the restored environment replaces the builtins
+    environment restored;
+    int is_restored = image_init_environment(&restored, "lib/test.image");
+    TEST_CHECK(env, is_restored);
+    restored.context = env->context;
+    test_number_output(&restored, "sq x", 25);
+    test_full_output(&restored, "xs", "{1 -2.5 \"s\" {#true}}");
+    test_integer_output(&restored, "big", -9007199254740993LL);
+    test_full_output(&restored, "ys", "[0 0.25 0.5 0.75 1]");
+    test_full_output(&restored, "zs", "<map {a {1 2}} {\"b\" [0 1]}>");
+    test_number_output(&restored, "plus 1 2", 3);
+    test_full_output(&restored, "plus", "<builtin plus>");
+    test_bool_output(&restored, "both #true #false", 0);
+    test_full_output(&restored, "sq", "<lambda {x} {* x x}>");
+    test_full_output(&restored, "(lambda {a} {a})", "<lambda {a} {a}>");
+    test_number_output(&restored, "PI", 3.1415926);
+    test_number_output(&restored, "min 1 2", 1);
+    test_error_output(&restored, "max", "undefined symbol: max");
+    test_error_output(&restored, "plus {}", "must be of type number");
+    environment_dispose(&restored);
+    remove("lib/test.image");
+
+    test_error_output(env, "dump 1", "arg #0 (1) must be of type string");
+    test_error_output(env, "dump \"nonexistent/test.image\"", "failed to dump image");
+    is_restored = image_init_environment(&restored, "nonexistent.image");
+    TEST_CHECK(env, !is_restored);
+    environment_dispose(&restored);
+    is_restored = image_init_environment(&restored, "lib/test.txt");
+    TEST_CHECK(env, !is_restored);
+    environment_dispose(&restored);
+}
+
+static void test_server_response(environment* env, int fd, int expected_status, char* expected) {
+    size_t length;
+    char* response = read_frame(fd, &length);
+    TEST_CHECK(env, response != NULL);
+    if (response == NULL) {
+        return;
+    }
+
+    fprintf(
+        environment_get_context(env)->output,
+        "\x1B[34m%-5d\x1B[0m "
+        "\x1B[34m[\x1B[0m%d %s\x1B[34m]\x1B[0m\n",
+        next_case_number(env), response[0], response + 1);
+
+    TEST_CHECK(env, response[0] == expected_status);
+    TEST_CHECK(env, strcmp(response + 1, expected) == 0);
+    free(response);
+}
+
+static void test_server(environment* env) {
+    int fds[2];
+    int paired = (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    TEST_CHECK(env, paired);
+    if (!paired) {
+        return;
+    }
+
+    // the requests see the warm environment, but can't change it
+    test_info_output(env, "def {warm} 5", "defined: warm");
+    char* requests[] = {
+        "def {sv} 5",
+        "sv",
+        "= {loc} 1",
+        "loc",
+        "(lambda {_} {+ sv 1}) (def {sv} 5)",
+        "+ warm 1",
+        "def {warm} 7",
+        "warm",
+        "{1 \"a\" {}}",
+        "head 1",
+        "{"};
+    size_t num_requests = sizeof(requests) / sizeof(char*);
+    for (size_t i = 0; i < num_requests; i++) {
+        int written = write_frame(fds[0], requests[i], strlen(requests[i]));
+        TEST_CHECK(env, written);
+    }
+    shutdown(fds[0], SHUT_WR);
+
+    // the connection is served until the client stops writing
+    serve_connection(env, fds[1]);
+    close(fds[1]);
+
+    test_server_response(env, fds[0], 0, "defined: sv");
+    test_server_response(env, fds[0], 1, "undefined symbol: sv");
+    test_server_response(env, fds[0], 0, "defined: loc");
+    test_server_response(env, fds[0], 1, "undefined symbol: loc");
+    test_server_response(env, fds[0], 0, "6");
+    test_server_response(env, fds[0], 0, "6");
+    test_server_response(env, fds[0], 0, "defined: warm");
+    test_server_response(env, fds[0], 0, "5");
+    test_server_response(env, fds[0], 0, "{1 \"a\" {}}");
+    test_server_response(env, fds[0], 1, "head: arg #0 (1) must be of type q-expr, but got integer");
+    test_server_response(env, fds[0], 1, "parsing error at 2: missing '}'");
+    close(fds[0]);
+
+    test_error_output(env, "sv", "undefined symbol: sv");
+    test_error_output(env, "loc", "undefined symbol: loc");
+    test_number_output(env, "warm", 5);
+}
+
+typedef int (*script_runner)(script_streams* s, char* image, char* arg, int argc, char** argv);
+
+// the mode is run on streams in memory, checking its exit
+// status, its output and (a part of) its error output
+static void test_script_streams(
+    environment* env, script_runner run, char* arg, char* input, int argc, char** argv,
+    int expected_status, char* expected_output, char* expected_error) {
+    char* output = NULL;
+    char* error = NULL;
+    size_t output_length = 0;
+    size_t error_length = 0;
+
+    script_streams s;
+    s.in = fmemopen(input, strlen(input), "r");
+    s.out = open_memstream(&output, &output_length);
+    s.err = open_memstream(&error, &error_length);
+    int status = run(&s, NULL, arg, argc, argv);
+    fclose(s.in);
+    fclose(s.out);
+    fclose(s.err);
+
+    fprintf(
+        environment_get_context(env)->output,
+        "\x1B[34m%-5d\x1B[0m "
+        "\x1B[34m[\x1B[0m%s\x1B[34m]\x1B[0m "
+        "\x1B[34m-->\x1B[0m "
+        "\x1B[34m[\x1B[0m%d %s%s\x1B[34m]\x1B[0m\n",
+        next_case_number(env), arg, status, output, error);
+
+    TEST_CHECK(env, status == expected_status);
+    TEST_CHECK(env, strcmp(output, expected_output) == 0);
+    TEST_CHECK(env, strstr(error, expected_error) != NULL);
+    free(output);
+    free(error);
+}
+
+static void test_script(environment* env) {
+    char* args[] = {"a", "b c"};
+
+    FILE* file = fopen("lib/script.txt", "w");
+    fputs("(print (len argv) argv)\n(def {x} 2)\n(print (* x 3))\n", file);
+    fclose(file);
+    test_script_streams(env, run_script, "lib/script.txt", "", 2, args, 0,
+                        "3 {\"lib/script.txt\" \"a\" \"b c\"}\n6\n", "");
+
+    // the first error stops the script with status 1
+    file = fopen("lib/script.txt", "w");
+    fputs("(print 1)\n(head 1)\n(print 2)\n", file);
+    fclose(file);
+    test_script_streams(env, run_script, "lib/script.txt", "", 0, NULL, 1,
+                        "1\n", "lib/script.txt: head: arg #0 (1) must be of type q-expr");
+    remove("lib/script.txt");
+
+    test_script_streams(env, run_script, "-", "(print \"in\")\n(print argv)", 1, args, 0,
+                        "\"in\"\n{\"-\" \"a\"}\n", "");
+    test_script_streams(env, run_script, "-", "(print \"a\xff" "b\")", 0, NULL, 0,
+                        "\"a\xff" "b\"\n", "");
+    test_script_streams(env, run_script, "-", "(print 1)\n(print {", 0, NULL, 1,
+                        "1\n", "-: parsing error");
+    test_script_streams(env, run_script, "lib/nonexistent.txt", "", 0, NULL, 1,
+                        "", "failed to open file: lib/nonexistent.txt");
+
+    test_script_streams(env, run_expression, "+ 1 2", "", 0, NULL, 0, "3\n", "");
+    test_script_streams(env, run_expression, "argv", "", 2, args, 0, "{\"-e\" \"a\" \"b c\"}\n", "");
+    test_script_streams(env, run_expression, "print \"x\"", "", 0, NULL, 0, "\"x\"\n", "");
+    test_script_streams(env, run_expression, "head 1", "", 0, NULL, 1,
+                        "", "head: arg #0 (1) must be of type q-expr");
+    test_script_streams(env, run_expression, "(", "", 0, NULL, 1, "", "parsing error");
+}
+
+static void test_lines(environment* env) {
+    char* args[] = {"x"};
+
+    // the strings are written raw, the other values printed
+    test_script_streams(env, run_lines, "sjoin line \"!\"", "a\nb \"c\"\n", 0, NULL, 0, "a!\nb \"c\"!\n", "");
+    test_script_streams(env, run_lines, "nr", "a\nb\nc", 0, NULL, 0, "1\n2\n3\n", "");
+    test_script_streams(env, run_lines, "list nr line", "a\n\nb\n", 0, NULL, 0, "{1 \"a\"}\n{2 \"\"}\n{3 \"b\"}\n", "");
+    test_script_streams(env, run_lines, "argv", "a\n", 1, args, 0, "{\"-n\" \"x\"}\n", "");
+    test_script_streams(env, run_lines, "print (slen line)", "abc\nde\n", 0, NULL, 0, "3\n2\n", "");
+    test_script_streams(env, run_lines, "nr", "", 0, NULL, 0, "", "");
+
+    // the bindings persist from line to line
+    test_script_streams(env, run_lines, "(lambda {_} {total}) (def {total} (+ nr (if (== nr 1) {0} {total})))",
+                        "a\nb\nc\n", 0, NULL, 0, "1\n3\n6\n", "");
+
+    // the first error stops the lines with status 1
+    test_script_streams(env, run_lines, "if (== nr 2) {error \"bad\"} {line}", "a\nb\nc\n", 0, NULL, 1,
+                        "a\n", "line 2: bad");
+    test_script_streams(env, run_lines, "{", "a\n", 0, NULL, 1, "", "parsing error");
+}
+
+static void test_file(environment* env) {
+    test_info_output(env, "def {f} (fopen \"lib/test.out\" \"w\")", "defined: f");
+    test_full_output(env, "f", "<file lib/test.out w>");
+    test_full_output(env, "fwrite f \"line 1\\n\" 2 \"\\n\" {a \"b\"} \"\\n\"", "()");
+    test_full_output(env, "fflush f", "()");
+    test_full_output(env, "fclose f", "()");
+    test_full_output(env, "f", "<file lib/test.out closed>");
+    test_error_output(env, "fwrite f \"x\"", "fwrite: arg #0 (<file lib/test.out>) is closed");
+    test_error_output(env, "fclose f", "is closed");
+
+    test_info_output(env, "def {f} (fopen \"lib/test.out\" \"a\")", "defined: f");
+    test_full_output(env, "fwrite f \"last\"", "()");
+    test_full_output(env, "fclose f", "()");
+
+    test_info_output(env, "def {f} (fopen \"lib/test.out\")", "defined: f");
+    test_bool_output(env, "== f f", 1);
+    test_full_output(env, "freadline f", "\"line 1\"");
+    test_full_output(env, "freadline f", "\"2\"");
+    test_full_output(env, "freadline f", "\"{a \\\"b\\\"}\"");
+    test_full_output(env, "freadline f", "\"last\"");
+    test_full_output(env, "freadline f", "{}");
+    test_full_output(env, "freadline f", "{}");
+    test_full_output(env, "fclose f", "()");
+
+    test_info_output(env, "def {f} (fopen \"lib/test.out\" \"r\")", "defined: f");
+    test_full_output(env, "fread f 4", "\"line\"");
+    test_full_output(env, "fread f 3", "\" 1\\n\"");
+    test_full_output(env, "fread f", "\"2\\n{a \\\"b\\\"}\\nlast\"");
+    test_full_output(env, "fread f", "{}");
+    test_error_output(env, "fwrite f \"x\"", "failed to write to file");
+    test_full_output(env, "fclose f", "()");
+
+    // the lines are streamed through the function
+    test_info_output(env, "def {f} (fopen \"lib/test.out\")", "defined: f");
+    test_number_output(env, "feach f (lambda {l} {def {lastline} l})", 4);
+    test_full_output(env, "lastline", "\"last\"");
+    test_number_output(env, "feach f print", 0);
+    test_full_output(env, "fclose f", "()");
+    test_info_output(env, "def {f} (fopen \"lib/test.out\")", "defined: f");
+    test_error_output(env, "feach f (lambda {l} {head l})", "must be of type q-expr");
+    test_full_output(env, "freadline f", "\"2\"");
+    test_number_output(env, "feach f (lambda {l} {fclose f})", 1);
+    test_full_output(env, "f", "<file lib/test.out closed>");
+    remove("lib/test.out");
+
+    test_error_output(env, "fopen \"nonexistent/test.out\" \"w\"", "failed to open file");
+    test_error_output(env, "fopen \"lib/test.txt\" \"x\"", "fopen: invalid mode: x");
+    test_error_output(env, "fopen \"lib/test.txt\" \"r\" 1", "fopen expects at most 2 args");
+    test_error_output(env, "fopen 1", "arg #0 (1) must be of type string");
+    test_error_output(env, "freadline 1", "arg #0 (1) must be of type file");
+    test_info_output(env, "def {f} (fopen \"lib/test.txt\")", "defined: f");
+    test_error_output(env, "fread f 0", "fread: arg #1 must be positive");
+    test_error_output(env, "fread f 1.5", "fread: arg #1 (1.5) must be a non-negative integer");
+    test_error_output(env, "fread f (- (^ 10 400) (^ 10 400))", "must be a non-negative integer");
+    test_error_output(env, "fread f 1e30", "fread: arg #1 is too large");
+    test_error_output(env, "fread f (^ 10 400)", "fread: arg #1 is too large");
+    test_error_output(env, "feach f 1", "arg #1 (1) must be of type function");
+    test_error_output(env, "fwrite f", "fwrite expects at least 2 args");
+    test_error_output(env, "if f {1} {2}", "can't cast file to bool");
+}
+
+static mylisp_value* test_callback(mylisp_value** args, size_t num_args, char* name, mylisp_environment* env) {
+    int* num_calls = mylisp_get_userdata(mylisp_from_environment(env));
+    (*num_calls)++;
+
+    double x;
+    if (num_args != 1 || !mylisp_to_double(args[0], &x)) {
+        return mylisp_error("expects a number");
+    }
+
+    return mylisp_number(x * 10);
+}
+
+static void test_embedding(environment* env) {
+    int num_calls = 0;
+    mylisp* m = mylisp_create();
+    mylisp_set_userdata(m, &num_calls);
+
+    double x;
+    mylisp_value* v = mylisp_eval(m, "+ 1 2");
+    TEST_CHECK(env, !mylisp_is_error(v));
+    TEST_CHECK(env, mylisp_to_double(v, &x) && x == 3);
+    TEST_CHECK(env, mylisp_to_string(v) == NULL);
+    mylisp_release(v);
+
+    v = mylisp_eval(m, "sjoin \"a\" \"b\"");
+    TEST_CHECK(env, strcmp(mylisp_to_string(v), "ab") == 0);
+    TEST_CHECK(env, !mylisp_to_double(v, &x));
+    mylisp_release(v);
+
+    v = mylisp_eval(m, "head 1");
+    TEST_CHECK(env, mylisp_is_error(v));
+    TEST_CHECK(env, strstr(mylisp_to_string(v), "must be of type q-expr"));
+    mylisp_release(v);
+
+    v = mylisp_eval(m, "{1 \"a\" {}}");
+    char* printed = mylisp_print(v);
+    TEST_CHECK(env, strcmp(printed, "{1 \"a\" {}}") == 0);
+    free(printed);
+    mylisp_release(v);
+
+    // a compiled form is evaluated without parsing
+    v = mylisp_eval(m, "fn {sq x} {* x x}");
+    mylisp_release(v);
+    mylisp_value* y = mylisp_number(4);
+    mylisp_set(m, "y", y);
+    mylisp_release(y);
+    mylisp_value* compiled = mylisp_compile("sq y");
+    for (int i = 0; i < 3; i++) {
+        v = mylisp_eval_compiled(m, compiled);
+        TEST_CHECK(env, mylisp_to_double(v, &x) && x == 16);
+        mylisp_release(v);
+    }
+    mylisp_release(compiled);
+
+    compiled = mylisp_compile("(");
+    v = mylisp_eval_compiled(m, compiled);
+    TEST_CHECK(env, mylisp_is_error(v));
+    mylisp_release(v);
+    mylisp_release(compiled);
+
+    // functions are called without going through text
+    mylisp_value* fn = mylisp_get(m, "sq");
+    mylisp_value* arg = mylisp_number(1.5);
+    v = mylisp_call(m, fn, &arg, 1);
+    TEST_CHECK(env, mylisp_to_double(v, &x) && x == 2.25);
+    mylisp_release(v);
+    mylisp_release(fn);
+    fn = mylisp_get(m, "max");
+    v = mylisp_call(m, fn, &arg, 1);
+    TEST_CHECK(env, mylisp_to_double(v, &x) && x == 1.5);
+    mylisp_release(v);
+    mylisp_release(fn);
+    v = mylisp_call(m, arg, &arg, 1);
+    TEST_CHECK(env, mylisp_is_error(v));
+    mylisp_release(v);
+    mylisp_release(arg);
+
+    mylisp_register(m, "times-ten", test_callback);
+    v = mylisp_eval(m, "times-ten (sq 3)");
+    TEST_CHECK(env, mylisp_to_double(v, &x) && x == 90);
+    mylisp_release(v);
+    v = mylisp_eval(m, "times-ten \"a\"");
+    TEST_CHECK(env, strcmp(mylisp_to_string(v), "expects a number") == 0);
+    mylisp_release(v);
+    TEST_CHECK(env, num_calls == 2);
+
+    mylisp_destroy(m);
+}
+
+#define TEST_NUM_THREADS 4
+
+typedef struct test_thread {
+    int index;
+    char* output;
+    size_t length;
+    test_state state;
+} test_thread;
+
+static void* run_test_thread(void* arg) {
+    test_thread* t = arg;
+
+    // each thread runs an interpreter of its own,
+    // writing into its own output stream
+    environment env;
+    environment_init(&env);
+    environment_register_builtins(&env);
+    env.context.output = open_memstream(&t->output, &t->length);
+    env.context.userdata = &t->state;
+
+    char input[64];
+    sprintf(input, "def {id} %d", t->index);
+    test_info_output(&env, input, "defined: id");
+    test_info_output(&env, "fn {fib n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}", "defined: fib");
+    test_number_output(&env, "fib 15", 610);
+    test_full_output(&env, "print \"thread\" id", "()");
+    test_info_output(&env, "load \"lib/test.txt\"", "evaluated 4 expressions");
+    test_number_output(&env, "f-add id 10", t->index + 10);
+    TEST_CHECK(&env, t->state.num_cases == 6);
+
+    fclose(env.context.output);
+    environment_dispose(&env);
+
+    return NULL;
+}
+
+static void test_threads(environment* env) {
+    test_state* state = environment_get_context(env)->userdata;
+
+    test_thread threads[TEST_NUM_THREADS];
+    pthread_t ids[TEST_NUM_THREADS];
+    int num_threads = 0;
+    for (; num_threads < TEST_NUM_THREADS; num_threads++) {
+        threads[num_threads].index = num_threads;
+        test_state_init(&threads[num_threads].state, state->budget);
+        if (pthread_create(&ids[num_threads], NULL, run_test_thread, &threads[num_threads]) != 0) {
+            break;
+        }
+    }
+    TEST_CHECK(env, num_threads == TEST_NUM_THREADS);
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(ids[i], NULL);
+
+        char expected[64];
+        sprintf(expected, "\"thread\" %d\n", i);
+        TEST_CHECK(env, strstr(threads[i].output, expected) != NULL);
+
+        fputs(threads[i].output, environment_get_context(env)->output);
+        free(threads[i].output);
+        state->num_failures += threads[i].state.num_failures;
+    }
+}
+
+static char* get_range_str(char* buffer, int begin, int end) {
+    char* running = buffer;
+    running += sprintf(running, "{");
+    for (int i = begin; i < end; i++) {
+        running += sprintf(running, (i > begin) ? " %d" : "%d", i);
+    }
+    sprintf(running, "}");
+
+    return buffer;
+}
+
+static void test_pmap(environment* env) {
+    test_full_output(env, "pmap (lambda {x} {* x x}) {1 2 3 4 5}", "{1 4 9 16 25}");
+    test_full_output(env, "pmap - {1 -2 3}", "{-1 2 -3}");
+    test_full_output(env, "pmap head {{1 2} {3} {{4}}}", "{{1} {3} {{4}}}");
+    test_full_output(env, "pmap (lambda {x} {x}) {}", "{}");
+    test_full_output(env, "pmap (lambda {x} {pmap (lambda {y} {* x y}) {1 2 3}}) {1 2}", "{{1 2 3} {2 4 6}}");
+
+    // the items are spread over chunks on the pool's threads
+    char input[8192];
+    char range[4096];
+    sprintf(input, "def {r} %s", get_range_str(range, 0, 1000));
+    test_info_output(env, input, "defined: r");
+    test_info_output(env, "fn {sq x} {* x x}", "defined: sq");
+    test_number_output(env, "eval (cons + (pmap sq r))", 332833500);
+    test_full_output(env, "== (pmap sq r) (eval (cons list (pmap (lambda {x} {sq x}) r)))", "#true");
+
+    // the error of the lowest index wins
+    test_error_output(env, "pmap (lambda {x} {if (== (% x 100) 99) {error x} {x}}) r", "99");
+    test_error_output(env, "pmap (lambda {x} {if (> x 10) {error \"late\"} {head x}}) r", "head: arg #0 (0)");
+    test_error_output(env, "pmap (lambda {x} {if (== x 999) {error \"last\"} {x}}) r", "last");
+
+    // the bindings are snapshots
+    test_info_output(env, "def {g} 10", "defined: g");
+    test_full_output(env, "pmap (lambda {x} {+ x g}) {1 2}", "{11 12}");
+    test_full_output(env, "(lambda {g} {pmap (lambda {x} {+ x g}) {1 2}}) 100", "{101 102}");
+    test_info_output(env, "del {max}", "deleted: max");
+    test_error_output(env, "pmap (lambda {x} {max x}) {1 2}", "undefined symbol: max");
+    test_number_output(env, "len (pmap (lambda {x} {def {g} x}) {1 2})", 2);
+    test_number_output(env, "g", 10);
+
+    // the snapshots share the bound values instead of copying them
+    test_snapshots_share_globals(env, "len (pmap (lambda {x} {* x 2}) r)");
+
+    test_error_output(env, "pmap 1 {1}", "arg #0 (1) must be of type function");
+    test_error_output(env, "pmap + 1", "arg #1 (1) must be of type q-expr");
+    test_error_output(env, "pmap +", "pmap expects exactly 2 args");
+}
+
+static void test_preduce(environment* env) {
+    test_number_output(env, "preduce + 0 {1 2 3 4 5}", 15);
+    test_number_output(env, "preduce * 1 {1 2 3 4 5}", 120);
+    test_number_output(env, "preduce min 100 {3 -2 7}", -2);
+    test_number_output(env, "preduce max -100 {3 -2 7}", 7);
+    test_number_output(env, "preduce + 42 {}", 42);
+    test_full_output(env, "preduce join {} {}", "{}");
+
+    // the partial results are combined in order
+    char input[8192];
+    char range[4096];
+    sprintf(input, "def {r} %s", get_range_str(range, 0, 1000));
+    test_info_output(env, input, "defined: r");
+    test_number_output(env, "preduce + 0 r", 499500);
+    test_number_output(env, "preduce max 0 r", 999);
+    test_number_output(env, "preduce (lambda {a b} {+ a b}) 0 r", 499500);
+    test_full_output(env, "== (preduce join {} (pmap list r)) r", "#true");
+    test_full_output(env, "preduce join {} {{1} {2 3} {} {4}}", "{1 2 3 4}");
+
+    // the errors of the lowest index win
+    test_error_output(env, "preduce + 0 {1 2 {3} 4}", "+: arg #1 ({3}) must be of type number");
+    test_error_output(env, "preduce (lambda {a x} {if (> x 500) {error x} {+ a x}}) 0 r", "501");
+    test_error_output(env, "preduce (lambda {a x} {if (== x 999) {error \"last\"} {a}}) 0 r", "last");
+
+    // the chunks and the combining steps share the bound values
+    test_snapshots_share_globals(env, "preduce (lambda {a b} {+ a b}) 0 r");
+
+    test_error_output(env, "preduce 1 0 {1}", "arg #0 (1) must be of type function");
+    test_error_output(env, "preduce + 0 1", "arg #2 (1) must be of type q-expr");
+    test_error_output(env, "preduce + 0", "preduce expects exactly 3 args");
+}
+
+static void test_future(environment* env) {
+    test_info_output(env, "fn {fib n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}", "defined: fib");
+    test_info_output(env, "def {a b} (future {fib 12}) (future {fib 13})", "defined: a b");
+    test_number_output(env, "+ (await a) (await b)", 377);
+    test_number_output(env, "await a", 144);
+    test_full_output(env, "a", "<future done>");
+    test_bool_output(env, "== a a", 1);
+    test_bool_output(env, "== a b", 0);
+
+    // the futures see snapshots of the bindings
+    test_info_output(env, "def {x} 1", "defined: x");
+    test_info_output(env, "def {f} (future {def {x} 2})", "defined: f");
+    test_info_output(env, "await f", "defined: x");
+    test_number_output(env, "x", 1);
+    test_number_output(env, "(lambda {y} {await (future {+ x y})}) 10", 11);
+    test_info_output(env, "load \"lib/test.txt\"", "evaluated 4 expressions");
+    test_number_output(env, "await (future {f-sum (await (future {list 1 2 3}))})", 6);
+
+    test_full_output(env, "await (future {})", "()");
+    test_full_output(env, "await (future {{1 2}})", "{1 2}");
+    test_error_output(env, "await (future {head 1})", "must be of type q-expr");
+    test_error_output(env, "await (future {error \"e\"})", "e");
+
+    // futures dropped without awaiting
+    test_full_output(env, "len (list (future {fib 10}) (future {fib 11}))", "2");
+
+    // the snapshots share the bound values instead of copying them,
+    // and a pending future holds on to its snapshot until it's run
+    test_snapshots_share_globals(env, "await (future {fib 10})");
+    test_info_output(env, "def {c shared} (chan 1) {1 2 3}", "defined: c shared");
+    test_info_output(env, "def {pending} (future {+ (receive c) (len shared)})", "defined: pending");
+    binding* shared = get_global_binding(env, "shared");
+    TEST_CHECK(env, get_binding_refs(shared) == 2);
+    test_full_output(env, "send c 1", "()");
+    test_number_output(env, "await pending", 4);
+    TEST_CHECK(env, get_binding_refs(shared) == 1);
+
+    test_error_output(env, "future 1", "arg #0 (1) must be of type q-expr");
+    test_error_output(env, "future {1} {2}", "future expects exactly 1 arg");
+    test_error_output(env, "await 1", "arg #0 (1) must be of type future");
+    test_error_output(env, "if (future {1}) {1} {2}", "can't cast future to bool");
+}
+
+static void test_spawn(environment* env) {
+    test_info_output(env, "fn {pfib n} {if (< n 2) {n} {(lambda {a} {+ (sync a) (pfib (- n 2))}) (spawn {pfib (- n 1)})}}", "defined: pfib");
+    test_number_output(env, "pfib 1", 1);
+    test_number_output(env, "pfib 15", 610);
+    test_number_output(env, "sync (spawn {pfib 12})", 144);
+    test_full_output(env, "sync (spawn {})", "()");
+    test_full_output(env, "sync (spawn {{1 2}})", "{1 2}");
+    test_error_output(env, "sync (spawn {head 1})", "must be of type q-expr");
+
+    // the spawned tasks share the bound values instead of copying them
+    test_snapshots_share_globals(env, "pfib 10");
+
+    // a parallel mergesort over q-exprs
+    test_info_output(env, "fn {evens l} {if (== l {}) {{}} {join (head l) (odds (tail l))}}", "defined: evens");
+    test_info_output(env, "fn {odds l} {if (== l {}) {{}} {evens (tail l)}}", "defined: odds");
+    test_info_output(env, "fn {merge a b} {if (== a {}) {b} {if (== b {}) {a} {if (< (eval (head a)) (eval (head b))) {join (head a) (merge (tail a) b)} {join (head b) (merge a (tail b))}}}}", "defined: merge");
+    test_info_output(env, "fn {msort l} {if (< (len l) 2) {l} {(lambda {a} {merge (sync a) (msort (odds l))}) (spawn {msort (evens l)})}}", "defined: msort");
+    test_full_output(env, "msort {3 1 2}", "{1 2 3}");
+
+    char input[8192];
+    char range[4096];
+    sprintf(input, "def {r} %s", get_range_str(range, 0, 200));
+    test_info_output(env, input, "defined: r");
+    test_full_output(env, "== (msort (pmap (lambda {x} {% (* x 37) 200}) r)) r", "#true");
+
+    // futures of either kind can be synced and awaited
+    test_number_output(env, "sync (future {+ 1 2})", 3);
+    test_number_output(env, "await (spawn {+ 1 2})", 3);
+
+    test_error_output(env, "spawn 1", "arg #0 (1) must be of type q-expr");
+    test_error_output(env, "spawn {1} {2}", "spawn expects exactly 1 arg");
+    test_error_output(env, "sync 1", "arg #0 (1) must be of type future");
+}
+
+static void test_channel(environment* env) {
+    test_info_output(env, "def {c} (chan 4)", "defined: c");
+    test_full_output(env, "c", "<channel open>");
+    test_full_output(env, "send c 1", "()");
+    test_full_output(env, "send c {2 3}", "()");
+    test_full_output(env, "send c \"four\"", "()");
+    test_number_output(env, "receive c", 1);
+    test_full_output(env, "receive c", "{2 3}");
+    test_full_output(env, "receive c", "\"four\"");
+    test_bool_output(env, "== c c", 1);
+    test_bool_output(env, "== c (chan 1)", 0);
+
+    // a closed channel is drained before yielding {}
+    test_full_output(env, "send c 5", "()");
+    test_full_output(env, "close c", "()");
+    test_full_output(env, "c", "<channel closed>");
+    test_number_output(env, "receive c", 5);
+    test_full_output(env, "receive c", "{}");
+    test_error_output(env, "send c 6", "send: channel is closed");
+    test_error_output(env, "close c", "close: channel is closed already");
+
+    test_info_output(env, "def {a b} (chan 1) (chan 1)", "defined: a b");
+    test_full_output(env, "send b 7", "()");
+    test_full_output(env, "select a b", "{1 7}");
+    test_full_output(env, "send a 8", "()");
+    test_full_output(env, "select a b", "{0 8}");
+    test_full_output(env, "close a", "()");
+    test_full_output(env, "close b", "()");
+    test_full_output(env, "select a b", "{}");
+    test_info_output(env, "def {d} (chan 1)", "defined: d");
+    test_full_output(env, "send d 3", "()");
+    test_full_output(env, "select d d", "{0 3}");
+
+    if (pool_get_num_threads() > 1) {
+        // a pipeline of stages on the pool, through channels
+        // with less room than the values passing through
+        test_info_output(env, "def {in out} (chan 2) (chan 2)", "defined: in out");
+        test_info_output(env, "fn {produce n} {if (== n 0) {close in} {(lambda {_} {produce (- n 1)}) (send in n)}}", "defined: produce");
+        test_info_output(env, "fn {square n} {(lambda {x} {if (== x {}) {(lambda {_} {n}) (close out)} {(lambda {_} {square (+ n 1)}) (send out (* x x))}}) (receive in)}", "defined: square");
+        test_info_output(env, "fn {total acc} {(lambda {x} {if (== x {}) {acc} {total (+ acc x)}}) (receive out)}", "defined: total");
+        test_info_output(env, "def {p s} (future {produce 100}) (future {square 0})", "defined: p s");
+        test_number_output(env, "total 0", 338350);
+        test_full_output(env, "await p", "()");
+        test_number_output(env, "await s", 100);
+
+        // a select parks until either producer sends or closes
+        test_info_output(env, "def {x y} (chan 1) (chan 1)", "defined: x y");
+        test_info_output(env, "fn {feed c n} {if (== n 0) {close c} {(lambda {_} {feed c (- n 1)}) (send c n)}}", "defined: feed");
+        test_info_output(env, "fn {merge acc} {(lambda {r} {if (== r {}) {acc} {merge (+ acc (nth r 1))}}) (select x y)}", "defined: merge");
+        test_info_output(env, "def {px py} (future {feed x 50}) (future {feed y 50})", "defined: px py");
+        test_number_output(env, "merge 0", 2550);
+        test_full_output(env, "await px", "()");
+        test_full_output(env, "await py", "()");
+    }
+
+    test_error_output(env, "chan 0", "chan: capacity must be positive");
+    test_error_output(env, "chan (- (^ 10 400) (^ 10 400))", "chan: capacity must be positive");
+    test_error_output(env, "chan (^ 10 400)", "chan: capacity is too large");
+    test_error_output(env, "chan 10000000000000000000", "chan: can't allocate a channel of 10000000000000000000 values");
+    test_error_output(env, "chan 1e15", "chan: can't allocate a channel of 1000000000000000 values");
+    test_error_output(env, "chan {}", "arg #0 ({}) must be of type number");
+    test_error_output(env, "send 1 1", "arg #0 (1) must be of type channel");
+    test_error_output(env, "receive 1", "arg #0 (1) must be of type channel");
+    test_error_output(env, "select (chan 1) 1", "arg #1 (1) must be of type channel");
+    test_error_output(env, "if (chan 1) {1} {2}", "can't cast channel to bool");
+}
+
+static void test_array(environment* env) {
+    test_full_output(env, "array {}", "[]");
+    test_full_output(env, "array {1 2.5 -3}", "[1 2.5 -3]");
+    test_full_output(env, "arange 4", "[0 1 2 3]");
+    test_full_output(env, "arange 1 3", "[1 2]");
+    test_full_output(env, "arange 0 1 0.25", "[0 0.25 0.5 0.75]");
+    test_full_output(env, "arange 10 0 -3", "[10 7 4 1]");
+    test_full_output(env, "arange 3 1", "[]");
+    test_full_output(env, "arange 20", "[0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 ...]");
+    test_full_output(env, "vlist (arange 3)", "{0 1 2}");
+    test_number_output(env, "len (arange 1000)", 1000);
+    test_bool_output(env, "== (array {0 1 2}) (arange 3)", 1);
+    test_bool_output(env, "== (arange 3) (arange 4)", 0);
+
+    // odd lengths leave elements past the last full vector
+    test_full_output(env, "v+ (arange 7) (arange 7)", "[0 2 4 6 8 10 12]");
+    test_full_output(env, "v- (arange 7) 1", "[-1 0 1 2 3 4 5]");
+    test_full_output(env, "v- 1 (arange 7)", "[1 0 -1 -2 -3 -4 -5]");
+    test_full_output(env, "v* 2 (arange 5)", "[0 2 4 6 8]");
+    test_full_output(env, "v/ (arange 5) 2", "[0 0.5 1 1.5 2]");
+    test_full_output(env, "v/ 12 (arange 1 6)", "[12 6 4 3 2.4]");
+    test_full_output(env, "v/ (array {1 -1 0}) 0", "[inf -inf -nan]");
+    test_number_output(env, "vsum (array {})", 0);
+    test_number_output(env, "vsum (arange 1001)", 500500);
+    test_number_output(env, "vdot (arange 5) (arange 5)", 30);
+    test_number_output(env, "vdot (arange 1 4) (array {2 0 -1})", -1);
+    test_number_output(env, "vmin (array {3 -1 4 -1 5 -9 2 6 -5})", -9);
+    test_number_output(env, "vmax (array {3 -1 4 -1 5 -9 2 6 -5})", 6);
+    test_number_output(env, "vmin (array {7})", 7);
+    test_number_output(env, "vmax (v- 0 (arange 37))", 0);
+
+    // the slices share the elements, starting anywhere in them
+    test_info_output(env, "def {xs} (arange 10)", "defined: xs");
+    test_full_output(env, "vslice xs 3 8", "[3 4 5 6 7]");
+    test_full_output(env, "vslice xs 7", "[7 8 9]");
+    test_full_output(env, "vslice xs 10", "[]");
+    test_full_output(env, "v* (vslice xs 1 6) (vslice xs 3 8)", "[3 8 15 24 35]");
+    test_number_output(env, "vsum (vslice xs 1 8)", 28);
+    test_number_output(env, "vmax (vslice xs 0 9)", 8);
+    test_full_output(env, "xs", "[0 1 2 3 4 5 6 7 8 9]");
+
+    test_error_output(env, "array {1 {2}}", "must consist of number children, but got q-expr");
+    test_error_output(env, "array 1", "arg #0 (1) must be of type q-expr");
+    test_error_output(env, "arange 0 1 0", "step must be non-zero");
+    test_error_output(env, "arange 1e300", "range is too long");
+    test_error_output(env, "arange 1e18", "can't allocate an array of 1000000000000000000 numbers");
+    test_error_output(env, "vslice xs 5 4", "slice [5, 4) is out of the range of 10 numbers");
+    test_error_output(env, "vslice xs 0 11", "out of the range");
+    test_error_output(env, "vslice xs -1", "vslice: arg #1 (-1) must be a non-negative integer");
+    test_error_output(env, "vslice xs 1.5", "vslice: arg #1 (1.5) must be a non-negative integer");
+    test_error_output(env, "vslice xs 0 (- (^ 10 400) (^ 10 400))", "vslice: arg #2 (-nan) must be a non-negative integer");
+    test_error_output(env, "len (vslice (arange 10) (- (^ 10 400) (^ 10 400)))", "must be a non-negative integer");
+    test_error_output(env, "vslice xs 0 (^ 10 400)", "out of the range");
+    test_error_output(env, "v+ 1 2", "one of the args must be an array");
+    test_error_output(env, "v+ xs {1}", "arg #1 ({1}) must be of type number");
+    test_error_output(env, "v* xs (arange 3)", "must be of the same length, but got 10 and 3");
+    test_error_output(env, "vdot xs (arange 3)", "must be of the same length");
+    test_error_output(env, "vmin (array {})", "must be non-empty");
+    test_error_output(env, "vsum {1 2}", "arg #0 ({1 2}) must be of type array, but got q-expr");
+    test_error_output(env, "< xs xs", "incomprable type: array");
+}
+
+static void test_hmap(environment* env) {
+    test_full_output(env, "hmap {}", "<map>");
+    test_full_output(env, "hmap {{\"a\" 1} {b 2} {3 {x y}}}", "<map {\"a\" 1} {b 2} {3 {x y}}>");
+    test_full_output(env, "hmap {{1 a} {2 b} {1 c}}", "<map {1 c} {2 b}>");
+    test_number_output(env, "len (hmap {{1 a} {2 b}})", 2);
+    test_bool_output(env, "if (hmap {}) {#true} {#false}", 0);
+
+    // the keys are hashed by value, across the types of numbers
+    test_info_output(env, "def {m} (hmap {{1 one} {\"1\" string} {{1 2} pair} {#true yes}})", "defined: m");
+    test_full_output(env, "hget m 1", "one");
+    test_full_output(env, "hget m 1.0", "one");
+    test_full_output(env, "hget m \"1\"", "string");
+    test_full_output(env, "hget m {1 2}", "pair");
+    test_full_output(env, "hget m #true", "yes");
+    test_full_output(env, "hget m 2 \"none\"", "\"none\"");
+    test_bool_output(env, "hhas m {1 2.0}", 1);
+    test_bool_output(env, "hhas (hmap {{9007199254740993 a}}) 9007199254740992.0", 0);
+    test_bool_output(env, "hhas (hmap {{9007199254740992 a}}) 9007199254740992.0", 1);
+    test_bool_output(env, "hhas m {2 1}", 0);
+    test_bool_output(env, "hhas m -0", 0);
+    test_bool_output(env, "hhas (hmap {{0 zero}}) -0", 1);
+
+    // the copies of a map share it, and the changes are seen by all
+    test_full_output(env, "hput m 2 \"two\"", "<map {1 one} {\"1\" string} {{1 2} pair} {#true yes} {2 \"two\"}>");
+    test_full_output(env, "hput (hput m 3 {three}) 1 {uno}", "<map {1 {uno}} {\"1\" string} {{1 2} pair} {#true yes} {2 \"two\"} {3 {three}}>");
+    test_full_output(env, "hdel m \"1\"", "<map {1 {uno}} {{1 2} pair} {#true yes} {2 \"two\"} {3 {three}}>");
+    test_full_output(env, "hkeys m", "{1 {1 2} #true 2 3}");
+    test_full_output(env, "hvals m", "{{uno} pair yes \"two\" {three}}");
+    test_full_output(env, "hitems (hmap {{a 1} {b 2}})", "{{a 1} {b 2}}");
+    test_full_output(env, "hmap (hitems m)", "<map {1 {uno}} {{1 2} pair} {#true yes} {2 \"two\"} {3 {three}}>");
+
+    test_bool_output(env, "== (hmap {{1 a} {2 b}}) (hmap {{2 b} {1 a}})", 1);
+    test_bool_output(env, "== (hmap {{1 a} {2 b}}) (hmap {{1 a} {2 c}})", 0);
+    test_bool_output(env, "== (hmap {{1 a}}) (hmap {{1 a} {2 b}})", 0);
+    test_bool_output(env, "== (hmap {{1 {x}}}) (hmap {{1.0 {x}}})", 1);
+    test_bool_output(env, "== m m", 1);
+
+    // many insertions, deletions and resizes, on the pool's threads
+    char input[8192];
+    char range[4096];
+    sprintf(input, "def {r} %s", get_range_str(range, 0, 1000));
+    test_info_output(env, input, "defined: r");
+    test_info_output(env, "def {squares} (hmap {})", "defined: squares");
+    test_number_output(env, "len (pmap (lambda {x} {hput squares x (* x x)}) r)", 1000);
+    test_number_output(env, "len squares", 1000);
+    test_number_output(env, "hget squares 999", 998001);
+    test_number_output(env, "eval (cons + (hvals squares))", 332833500);
+    test_number_output(env, "len (pmap (lambda {x} {if (== (% x 2) 0) {hdel squares x} {x}}) r)", 1000);
+    test_number_output(env, "len squares", 500);
+    test_full_output(env, "hget squares 500 {}", "{}");
+    test_number_output(env, "hget squares 501", 251001);
+    test_bool_output(env, "hhas squares 1", 1);
+
+    test_error_output(env, "hget m 4", "hget: key not found: 4");
+    test_error_output(env, "hdel m 4", "hdel: key not found: 4");
+    test_error_output(env, "hget m +", "arg #1 (<builtin +>) must be hashable, but got function");
+    test_error_output(env, "hput m (hmap {}) 1", "must be hashable, but got map");
+    test_error_output(env, "hput m {(arange 2)} 1", "must be hashable, but got q-expr");
+
+    // a map can't be put in itself, however deep
+    test_error_output(env, "(lambda {m} {hput m 1 m}) (hmap {})", "hput: arg #2 must not contain the map itself");
+    test_error_output(env, "hput m 4 m", "must not contain the map itself");
+    test_error_output(env, "hput m 4 (list 1 (list m))", "must not contain the map itself");
+    test_error_output(env, "hput m 4 (lambda {} (list m))", "must not contain the map itself");
+    test_info_output(env, "def {n} (hmap {})", "defined: n");
+    test_full_output(env, "hput n 1 m", "<map {1 <map {1 {uno}} {{1 2} pair} {#true yes} {2 \"two\"} {3 {three}}>}>");
+    test_error_output(env, "hput m 4 (hmap (list (list 1 n)))", "must not contain the map itself");
+    test_error_output(env, "hput m 4 n", "must not contain the map itself");
+    test_full_output(env, "hput m 4 (hmap {})", "<map {1 {uno}} {{1 2} pair} {#true yes} {2 \"two\"} {3 {three}} {4 <map>}>");
+    test_error_output(env, "hmap {{1}}", "must be exactly 2-long");
+    test_error_output(env, "hmap {1 2}", "must consist of q-expr children, but got integer");
+    test_error_output(env, "hget {} 1", "arg #0 ({}) must be of type map, but got q-expr");
+    test_error_output(env, "< m m", "incomprable type: map");
+}
+
 static void test_sjoin(environment* env) {
     test_full_output(env, "sjoin \"a\" \"b\"", "\"ab\"");
     test_full_output(env, "sjoin \"abc\" \"de\" \"f\"", "\"abcdef\"");
@@ -1037,57 +2323,234 @@ static void test_slen(environment* env) {
     test_error_output(env, "slen \"a\" \"b\"", "expects exactly 1 arg");
 }
 
-void run_test() {
-    counter = 0;
-
-    RUN_TEST_FN(test_parsing);
-    RUN_TEST_FN(test_numeric);
-    RUN_TEST_FN(test_errors);
-    RUN_TEST_FN(test_full);
-    RUN_TEST_FN(test_special);
-    RUN_TEST_FN(test_string);
-    RUN_TEST_FN(test_comment);
-
-    RUN_TEST_FN(test_list);
-    RUN_TEST_FN(test_first);
-    RUN_TEST_FN(test_head);
-    RUN_TEST_FN(test_tail);
-    RUN_TEST_FN(test_join);
-    RUN_TEST_FN(test_eval);
-    RUN_TEST_FN(test_cons);
-    RUN_TEST_FN(test_len);
-    RUN_TEST_FN(test_init);
-
-    RUN_TEST_FN(test_def);
-    RUN_TEST_FN(test_lambda);
-    RUN_TEST_FN(test_parent_env);
-    RUN_TEST_FN(test_function_call);
-    RUN_TEST_FN(test_fn);
-    RUN_TEST_FN(test_del);
-
-    RUN_TEST_FN(test_eq);
-    RUN_TEST_FN(test_neq);
-    RUN_TEST_FN(test_gt);
-    RUN_TEST_FN(test_gte);
-    RUN_TEST_FN(test_lt);
-    RUN_TEST_FN(test_lte);
-    RUN_TEST_FN(test_null_q);
-    RUN_TEST_FN(test_zero_q);
-    RUN_TEST_FN(test_list_q);
-
-    RUN_TEST_FN(test_if);
-    RUN_TEST_FN(test_cond);
-    RUN_TEST_FN(test_recursion);
-
-    RUN_TEST_FN(test_and);
-    RUN_TEST_FN(test_or);
-    RUN_TEST_FN(test_not);
-
-    RUN_TEST_FN(test_seval);
-    RUN_TEST_FN(test_load);
-    RUN_TEST_FN(test_sjoin);
-    RUN_TEST_FN(test_shead);
-    RUN_TEST_FN(test_stail);
-    RUN_TEST_FN(test_sinit);
-    RUN_TEST_FN(test_slen);
+#define TEST_GROUP(fn) {#fn, fn}
+#define TEST_MAX_JOBS 64
+
+typedef struct test_group {
+    char* name;
+    void (*fn)(environment* env);
+} test_group;
+
+static test_group test_groups[] = {
+    TEST_GROUP(test_parsing),
+    TEST_GROUP(test_parse_parallel),
+    TEST_GROUP(test_numeric),
+    TEST_GROUP(test_integer),
+    TEST_GROUP(test_errors),
+    TEST_GROUP(test_full),
+    TEST_GROUP(test_print),
+    TEST_GROUP(test_special),
+    TEST_GROUP(test_string),
+    TEST_GROUP(test_comment),
+
+    TEST_GROUP(test_list),
+    TEST_GROUP(test_first),
+    TEST_GROUP(test_head),
+    TEST_GROUP(test_tail),
+    TEST_GROUP(test_join),
+    TEST_GROUP(test_eval),
+    TEST_GROUP(test_cons),
+    TEST_GROUP(test_len),
+    TEST_GROUP(test_init),
+    TEST_GROUP(test_nth),
+    TEST_GROUP(test_slice),
+    TEST_GROUP(test_take),
+    TEST_GROUP(test_drop),
+    TEST_GROUP(test_map),
+    TEST_GROUP(test_filter),
+    TEST_GROUP(test_foldl),
+    TEST_GROUP(test_foldr),
+    TEST_GROUP(test_sort),
+    TEST_GROUP(test_stable_sort),
+
+    TEST_GROUP(test_def),
+    TEST_GROUP(test_lambda),
+    TEST_GROUP(test_parent_env),
+    TEST_GROUP(test_function_call),
+    TEST_GROUP(test_fn),
+    TEST_GROUP(test_del),
+
+    TEST_GROUP(test_eq),
+    TEST_GROUP(test_neq),
+    TEST_GROUP(test_gt),
+    TEST_GROUP(test_gte),
+    TEST_GROUP(test_lt),
+    TEST_GROUP(test_lte),
+    TEST_GROUP(test_null_q),
+    TEST_GROUP(test_zero_q),
+    TEST_GROUP(test_list_q),
+
+    TEST_GROUP(test_if),
+    TEST_GROUP(test_cond),
+    TEST_GROUP(test_recursion),
+
+    TEST_GROUP(test_and),
+    TEST_GROUP(test_or),
+    TEST_GROUP(test_not),
+
+    TEST_GROUP(test_seval),
+    TEST_GROUP(test_load),
+    TEST_GROUP(test_dump),
+    TEST_GROUP(test_server),
+    TEST_GROUP(test_script),
+    TEST_GROUP(test_lines),
+    TEST_GROUP(test_sjoin),
+    TEST_GROUP(test_shead),
+    TEST_GROUP(test_stail),
+    TEST_GROUP(test_sinit),
+    TEST_GROUP(test_slen),
+    TEST_GROUP(test_file),
+    TEST_GROUP(test_embedding),
+    TEST_GROUP(test_threads),
+    TEST_GROUP(test_pmap),
+    TEST_GROUP(test_preduce),
+    TEST_GROUP(test_future),
+    TEST_GROUP(test_spawn),
+    TEST_GROUP(test_channel),
+    TEST_GROUP(test_array),
+    TEST_GROUP(test_hmap),
+};
+
+#define NUM_TEST_GROUPS (sizeof(test_groups) / sizeof(test_group))
+
+typedef struct test_result {
+    char* output;
+    size_t length;
+    test_state state;
+    double time;
+} test_result;
+
+typedef struct test_runner {
+    test_result results[NUM_TEST_GROUPS];
+    size_t next_group;
+    double budget;
+    int is_parallel;
+} test_runner;
+
+static void run_test_group(test_runner* runner, size_t index) {
+    test_group* group = &test_groups[index];
+    test_result* result = &runner->results[index];
+
+    // the groups running in parallel write into streams of
+    // their own, printed in order when all of them are done
+    FILE* output = stdout;
+    if (runner->is_parallel) {
+        output = open_memstream(&result->output, &result->length);
+    }
+
+    fprintf(output, "[%s]\n", group->name);
+    fprintf(output, "=========================\n");
+
+    test_state_init(&result->state, runner->budget);
+    environment env;
+    environment_init(&env);
+    environment_register_builtins(&env);
+    env.context.output = output;
+    env.context.userdata = &result->state;
+
+    double start = get_time_ms();
+    group->fn(&env);
+    result->time = get_time_ms() - start;
+
+    environment_dispose(&env);
+
+    fprintf(
+        output, "\x1B[90m%d cases, %.3f ms\x1B[0m\n\n",
+        result->state.num_cases, result->time);
+
+    if (runner->is_parallel) {
+        fclose(output);
+    } else {
+        fflush(output);
+    }
+}
+
+static void* run_test_groups(void* arg) {
+    test_runner* runner = arg;
+
+    size_t index;
+    while ((index = __sync_fetch_and_add(&runner->next_group, 1)) < NUM_TEST_GROUPS) {
+        run_test_group(runner, index);
+    }
+
+    return NULL;
+}
+
+static int print_test_usage() {
+    fprintf(stderr, "usage: test [-j <jobs>] [-b <budget ms per case>]\n");
+
+    return 2;
+}
+
+int run_test(int argc, char** argv) {
+    // the pool runs several threads even on a single core
+    setenv("MYLISP_THREADS", "4", 0);
+
+    long num_jobs = pool_get_num_threads();
+    double budget = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_jobs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            budget = atof(argv[++i]);
+        } else {
+            return print_test_usage();
+        }
+    }
+    if (num_jobs < 1 || num_jobs > TEST_MAX_JOBS || budget < 0) {
+        return print_test_usage();
+    }
+
+    // the groups run on threads of their own rather than on the pool,
+    // for the pool to be free to run the futures the groups start
+    test_runner* runner = calloc(1, sizeof(test_runner));
+    runner->budget = budget;
+    runner->is_parallel = (num_jobs > 1);
+
+    double start = get_time_ms();
+    if (runner->is_parallel) {
+        pthread_t ids[TEST_MAX_JOBS];
+        long num_threads = 0;
+        while (num_threads < num_jobs && pthread_create(&ids[num_threads], NULL, run_test_groups, runner) == 0) {
+            num_threads++;
+        }
+        if (num_threads < num_jobs) {
+            // short of threads, the groups left are run here too
+            run_test_groups(runner);
+        }
+        for (long i = 0; i < num_threads; i++) {
+            pthread_join(ids[i], NULL);
+        }
+    } else {
+        run_test_groups(runner);
+    }
+    double time = get_time_ms() - start;
+
+    int num_cases = 0;
+    int num_failures = 0;
+    for (size_t i = 0; i < NUM_TEST_GROUPS; i++) {
+        test_result* result = &runner->results[i];
+        if (runner->is_parallel) {
+            fwrite(result->output, 1, result->length, stdout);
+            free(result->output);
+        }
+        num_cases += result->state.num_cases;
+        num_failures += result->state.num_failures;
+    }
+
+    for (size_t i = 0; i < NUM_TEST_GROUPS; i++) {
+        if (runner->results[i].state.num_failures > 0) {
+            printf(
+                "\x1B[31mFAILED: %s (%d of %d cases)\x1B[0m\n",
+                test_groups[i].name, runner->results[i].state.num_failures,
+                runner->results[i].state.num_cases);
+        }
+    }
+    printf(
+        "%zu groups, %d cases, %d failed, %.3f ms on %ld jobs\n",
+        NUM_TEST_GROUPS, num_cases, num_failures, time, num_jobs);
+
+    free(runner);
+
+    return (num_failures > 0) ? 1 : 0;
 }
@@ -1,6 +1,6 @@
 #ifndef TEST_H_
 #define TEST_H_
 
-void run_test();
+int run_test(int argc, char** argv);
 
 #endif  // TEST_H_
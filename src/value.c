@@ -1,11 +1,17 @@
 #include "value.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "array.h"
+#include "channel.h"
+#include "future.h"
+#include "map.h"
 #include "str.h"
 
 value* value_new_number(double number) {
@@ -17,6 +23,18 @@ value* value_new_number(double number) {
     return v;
 }
 
+value* value_new_integer(int64_t integer) {
+    value* v = malloc(sizeof(value));
+
+    // the number is kept alongside, for the functions
+    // which take any number to read it as a double
+    v->type = VALUE_INTEGER;
+    v->integer = integer;
+    v->number = integer;
+
+    return v;
+}
+
 value* value_new_symbol(char* symbol) {
     value* v = malloc(sizeof(value));
 
@@ -132,6 +150,79 @@ value* value_new_function(value* function) {
     return result;
 }
 
+value* value_new_file(FILE* stream, char* path, char* mode) {
+    value* v = malloc(sizeof(value));
+
+    v->type = VALUE_FILE;
+    v->file = malloc(sizeof(value_file));
+    v->file->stream = stream;
+    v->file->path = malloc(strlen(path) + 1);
+    v->file->mode = malloc(strlen(mode) + 1);
+    v->file->num_refs = 1;
+
+    strcpy(v->file->path, path);
+    strcpy(v->file->mode, mode);
+
+    return v;
+}
+
+static value* value_copy_file(value* v) {
+    value* result = malloc(sizeof(value));
+
+    result->type = VALUE_FILE;
+    result->file = v->file;
+    __sync_fetch_and_add(&result->file->num_refs, 1);
+
+    return result;
+}
+
+static void value_dispose_file(value* v) {
+    if (__sync_sub_and_fetch(&v->file->num_refs, 1) == 0) {
+        if (v->file->stream != NULL) {
+            fclose(v->file->stream);
+        }
+        free(v->file->path);
+        free(v->file->mode);
+        free(v->file);
+    }
+}
+
+value* value_new_future(value_future* future) {
+    value* v = malloc(sizeof(value));
+
+    v->type = VALUE_FUTURE;
+    v->future = future;
+
+    return v;
+}
+
+value* value_new_channel(value_channel* channel) {
+    value* v = malloc(sizeof(value));
+
+    v->type = VALUE_CHANNEL;
+    v->channel = channel;
+
+    return v;
+}
+
+value* value_new_array(value_array* array) {
+    value* v = malloc(sizeof(value));
+
+    v->type = VALUE_ARRAY;
+    v->array = array;
+
+    return v;
+}
+
+value* value_new_map(value_map* map) {
+    value* v = malloc(sizeof(value));
+
+    v->type = VALUE_MAP;
+    v->map = map;
+
+    return v;
+}
+
 static value* value_new_expr(value_type type) {
     value* v = malloc(sizeof(value));
 
@@ -154,6 +245,7 @@ value* value_new_qexpr() {
 void value_dispose(value* v) {
     switch (v->type) {
         case VALUE_NUMBER:
+        case VALUE_INTEGER:
             break;
         case VALUE_SYMBOL:
         case VALUE_ERROR:
@@ -183,6 +275,21 @@ void value_dispose(value* v) {
             }
             free(v->children);
             break;
+        case VALUE_FILE:
+            value_dispose_file(v);
+            break;
+        case VALUE_FUTURE:
+            future_release(v->future);
+            break;
+        case VALUE_CHANNEL:
+            channel_release(v->channel);
+            break;
+        case VALUE_ARRAY:
+            array_release(v->array);
+            break;
+        case VALUE_MAP:
+            map_release(v->map);
+            break;
     }
 
     free(v);
@@ -207,6 +314,9 @@ value* value_copy(value* v) {
         case VALUE_NUMBER:
             result = value_new_number(v->number);
             break;
+        case VALUE_INTEGER:
+            result = value_new_integer(v->integer);
+            break;
         case VALUE_SYMBOL:
             result = value_new_symbol(v->symbol);
             break;
@@ -232,6 +342,24 @@ value* value_copy(value* v) {
                 value_add_child(result, value_copy(v->children[i]));
             }
             break;
+        case VALUE_FILE:
+            result = value_copy_file(v);
+            break;
+        case VALUE_FUTURE:
+            future_retain(v->future);
+            result = value_new_future(v->future);
+            break;
+        case VALUE_CHANNEL:
+            channel_retain(v->channel);
+            result = value_new_channel(v->channel);
+            break;
+        case VALUE_ARRAY:
+            result = array_slice(v->array, 0, v->array->length);
+            break;
+        case VALUE_MAP:
+            map_retain(v->map);
+            result = value_new_map(v->map);
+            break;
         default:
             result = value_new_error("unknown value type: %d", v->type);
     }
@@ -281,6 +409,8 @@ int value_to_str(value* v, char* buffer) {
     switch (v->type) {
         case VALUE_NUMBER:
             return sprintf(buffer, "%g", v->number);
+        case VALUE_INTEGER:
+            return sprintf(buffer, "%" PRId64, v->integer);
         case VALUE_SYMBOL:
             return sprintf(buffer, "%s", v->symbol);
         case VALUE_ERROR:
@@ -297,15 +427,106 @@ int value_to_str(value* v, char* buffer) {
             return expr_to_str(v, buffer, '(', ')');
         case VALUE_QEXPR:
             return expr_to_str(v, buffer, '{', '}');
+        case VALUE_FILE:
+            return sprintf(
+                buffer, "<file %s %s>", v->file->path,
+                (v->file->stream != NULL) ? v->file->mode : "closed");
+        case VALUE_FUTURE:
+            return sprintf(buffer, "<future %s>", future_is_done(v->future) ? "done" : "pending");
+        case VALUE_CHANNEL:
+            return sprintf(buffer, "<channel %s>", channel_is_closed(v->channel) ? "closed" : "open");
+        case VALUE_ARRAY:
+            return array_to_str(v->array, buffer);
+        case VALUE_MAP:
+            return map_to_str(v->map, buffer);
         default:
             return sprintf(buffer, "unknown value type: %d", v->type);
     }
 }
 
+static void expr_print(value* v, FILE* stream, char open, char close) {
+    fputc(open, stream);
+    for (size_t i = 0; i < v->num_children; i++) {
+        value_print(v->children[i], stream);
+        if (i < v->num_children - 1) {
+            fputc(' ', stream);
+        }
+    }
+    fputc(close, stream);
+}
+
+void value_print(value* v, FILE* stream) {
+    char* escaped;
+
+    switch (v->type) {
+        case VALUE_NUMBER:
+            fprintf(stream, "%g", v->number);
+            break;
+        case VALUE_INTEGER:
+            fprintf(stream, "%" PRId64, v->integer);
+            break;
+        case VALUE_SYMBOL:
+            fputs(v->symbol, stream);
+            break;
+        case VALUE_ERROR:
+            fprintf(stream, "\x1B[31m%s\x1B[0m", v->symbol);
+            break;
+        case VALUE_INFO:
+            fprintf(stream, "\x1B[32m%s\x1B[0m", v->symbol);
+            break;
+        case VALUE_STRING:
+            escaped = str_escape(v->symbol);
+            fprintf(stream, "\"%s\"", escaped);
+            free(escaped);
+            break;
+        case VALUE_BOOL:
+            fputs((v->number == 1) ? "#true" : "#false", stream);
+            break;
+        case VALUE_FUNCTION:
+            if (v->builtin != NULL) {
+                fprintf(stream, "<builtin %s>", v->symbol);
+            } else {
+                fputs("<lambda ", stream);
+                value_print(v->args, stream);
+                fputc(' ', stream);
+                value_print(v->body, stream);
+                fputc('>', stream);
+            }
+            break;
+        case VALUE_SEXPR:
+            expr_print(v, stream, '(', ')');
+            break;
+        case VALUE_QEXPR:
+            expr_print(v, stream, '{', '}');
+            break;
+        case VALUE_FILE:
+            fprintf(
+                stream, "<file %s %s>", v->file->path,
+                (v->file->stream != NULL) ? v->file->mode : "closed");
+            break;
+        case VALUE_FUTURE:
+            fprintf(stream, "<future %s>", future_is_done(v->future) ? "done" : "pending");
+            break;
+        case VALUE_CHANNEL:
+            fprintf(stream, "<channel %s>", channel_is_closed(v->channel) ? "closed" : "open");
+            break;
+        case VALUE_ARRAY:
+            array_print(v->array, stream);
+            break;
+        case VALUE_MAP:
+            map_print(v->map, stream);
+            break;
+        default:
+            fprintf(stream, "unknown value type: %d", v->type);
+    }
+}
+
 value* value_to_bool(value* v) {
     switch (v->type) {
         case VALUE_NUMBER:
             return value_new_bool((v->number != 0) ? 1 : 0);
+        case VALUE_INTEGER:
+            return value_new_bool((v->integer != 0) ? 1 : 0);
         case VALUE_SYMBOL:
         case VALUE_STRING:
             return value_new_bool((v->symbol != NULL && strlen(v->symbol) > 0) ? 1 : 0);
@@ -313,90 +534,108 @@ value* value_to_bool(value* v) {
             return value_new_error(v->symbol);
         case VALUE_INFO:
         case VALUE_FUNCTION:
+        case VALUE_FILE:
+        case VALUE_FUTURE:
+        case VALUE_CHANNEL:
             return value_new_error("can't cast %s to bool", get_value_type_name(v->type));
         case VALUE_BOOL:
             return value_new_bool(v->number);
         case VALUE_SEXPR:
         case VALUE_QEXPR:
             return value_new_bool((v->num_children > 0) ? 1 : 0);
+        case VALUE_ARRAY:
+            return value_new_bool((v->array->length > 0) ? 1 : 0);
+        case VALUE_MAP:
+            return value_new_bool((map_length(v->map) > 0) ? 1 : 0);
         default:
             return value_new_error("unknown value type: %d", v->type);
     }
 }
 
-value* value_compare(value* v1, value* v2) {
-    value* result = NULL;
-
-    if (v1->type != v2->type) {
-        result = value_new_error(
+// the order of the values (< 0, 0 or > 0) without allocating
+// a result: the error is only made if they can't be compared
+int value_order(value* v1, value* v2, value** error) {
+    if (value_is_number(v1) && value_is_number(v2)) {
+        return value_compare_numbers(v1, v2);
+    } else if (v1->type != v2->type) {
+        *error = value_new_error(
             "can't compare values of different types: %s and %s",
             get_value_type_name(v1->type),
             get_value_type_name(v2->type));
-    } else {
-        value* sub_result;
-        size_t min_children;
+        return 0;
+    }
 
-        switch (v1->type) {
-            case VALUE_NUMBER:
-                if (v1->number < v2->number) {
-                    result = value_new_number(-1);
-                } else if (v1->number > v2->number) {
-                    result = value_new_number(1);
-                } else {
-                    result = value_new_number(0);
-                }
-                break;
-            case VALUE_SYMBOL:
-            case VALUE_STRING:
-                result = value_new_number(strcmp(v1->symbol, v2->symbol));
-                break;
-            case VALUE_ERROR:
-            case VALUE_INFO:
-            case VALUE_BOOL:
-            case VALUE_FUNCTION:
-                result = value_new_error("incomprable type: %s", get_value_type_name(v1->type));
-                break;
-            case VALUE_SEXPR:
-            case VALUE_QEXPR:
-                min_children = v1->num_children;
-                if (v2->num_children < v1->num_children) {
-                    min_children = v2->num_children;
-                }
+    size_t min_children;
 
-                for (size_t i = 0; i < min_children; i++) {
-                    sub_result = value_compare(v1->children[i], v2->children[i]);
-                    if (sub_result->type == VALUE_ERROR || sub_result->number != 0) {
-                        result = sub_result;
-                        break;
-                    } else {
-                        value_dispose(sub_result);
-                    }
-                }
+    switch (v1->type) {
+        case VALUE_SYMBOL:
+        case VALUE_STRING:
+            return strcmp(v1->symbol, v2->symbol);
+        case VALUE_ERROR:
+        case VALUE_INFO:
+        case VALUE_BOOL:
+        case VALUE_FUNCTION:
+        case VALUE_FILE:
+        case VALUE_FUTURE:
+        case VALUE_CHANNEL:
+        case VALUE_ARRAY:
+        case VALUE_MAP:
+            *error = value_new_error("incomprable type: %s", get_value_type_name(v1->type));
+            return 0;
+        case VALUE_SEXPR:
+        case VALUE_QEXPR:
+            min_children = v1->num_children;
+            if (v2->num_children < v1->num_children) {
+                min_children = v2->num_children;
+            }
 
-                if (result == NULL) {
-                    result = value_new_number((int)v1->num_children - (int)v2->num_children);
+            for (size_t i = 0; i < min_children; i++) {
+                int order = value_order(v1->children[i], v2->children[i], error);
+                if (*error != NULL || order != 0) {
+                    return order;
                 }
-                break;
-            default:
-                result = value_new_error("unknown value type: %d", v1->type);
+            }
+
+            return (v1->num_children > v2->num_children) - (v1->num_children < v2->num_children);
+        default:
+            *error = value_new_error("unknown value type: %d", v1->type);
+            return 0;
+    }
+}
+
+value* value_compare(value* v1, value* v2) {
+    value* error = NULL;
+    int order = value_order(v1, v2, &error);
+
+    return (error != NULL) ? error : value_new_integer(order);
+}
+
+// the elements are compared as numbers (so 0 == -0)
+static int arrays_equal(value_array* a1, value_array* a2) {
+    if (a1->length != a2->length) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < a1->length; i++) {
+        if (a1->data[i] != a2->data[i]) {
+            return 0;
         }
     }
 
-    return result;
+    return 1;
 }
 
 value* value_equals(value* v1, value* v2) {
     value* result = NULL;
 
-    if (v1->type != v2->type) {
+    if (value_is_number(v1) && value_is_number(v2)) {
+        result = value_new_bool(value_numbers_equal(v1, v2));
+    } else if (v1->type != v2->type) {
         result = value_new_bool(0);
     } else {
         value* sub_result;
 
         switch (v1->type) {
-            case VALUE_NUMBER:
-                result = value_new_bool(v1->number == v2->number ? 1 : 0);
-                break;
             case VALUE_SYMBOL:
             case VALUE_ERROR:
             case VALUE_INFO:
@@ -447,6 +686,21 @@ value* value_equals(value* v1, value* v2) {
                     }
                 }
                 break;
+            case VALUE_FILE:
+                result = value_new_bool(v1->file == v2->file ? 1 : 0);
+                break;
+            case VALUE_FUTURE:
+                result = value_new_bool(v1->future == v2->future ? 1 : 0);
+                break;
+            case VALUE_CHANNEL:
+                result = value_new_bool(v1->channel == v2->channel ? 1 : 0);
+                break;
+            case VALUE_ARRAY:
+                result = value_new_bool(arrays_equal(v1->array, v2->array));
+                break;
+            case VALUE_MAP:
+                result = value_new_bool(map_equals(v1->map, v2->map));
+                break;
             default:
                 result = value_new_error("unknown value type: %d", v1->type);
         }
@@ -455,10 +709,58 @@ value* value_equals(value* v1, value* v2) {
     return result;
 }
 
+int value_is_number(value* v) {
+    return v->type == VALUE_NUMBER || v->type == VALUE_INTEGER;
+}
+
+// the integer isn't rounded to a double (2^53 + 1 would equal
+// 2^53 then, and the order wouldn't be transitive): the double is
+// compared with the range of the integers first, and within it
+// its integral part, then its fraction, is compared exactly
+static int compare_integer_with_double(int64_t integer, double number) {
+    if (isnan(number)) {
+        return 0;
+    } else if (number >= 9223372036854775808.0) {  // 2^63
+        return -1;
+    } else if (number < -9223372036854775808.0) {
+        return 1;
+    }
+
+    double integral = trunc(number);
+    int64_t truncated = (int64_t)integral;
+    if (integer != truncated) {
+        return (integer > truncated) - (integer < truncated);
+    }
+
+    double fraction = number - integral;
+    return (fraction < 0) - (fraction > 0);
+}
+
+// the numbers are compared exactly, integers and doubles mixed too;
+// the NaNs are neither less nor greater than any number
+int value_compare_numbers(value* v1, value* v2) {
+    if (v1->type == VALUE_INTEGER && v2->type == VALUE_INTEGER) {
+        return (v1->integer > v2->integer) - (v1->integer < v2->integer);
+    } else if (v1->type == VALUE_INTEGER) {
+        return compare_integer_with_double(v1->integer, v2->number);
+    } else if (v2->type == VALUE_INTEGER) {
+        return -compare_integer_with_double(v2->integer, v1->number);
+    } else {
+        return (v1->number > v2->number) - (v1->number < v2->number);
+    }
+}
+
+// the NaNs compare as neither less nor greater, but aren't equal
+int value_numbers_equal(value* v1, value* v2) {
+    return !isnan(v1->number) && !isnan(v2->number) && value_compare_numbers(v1, v2) == 0;
+}
+
 char* get_value_type_name(value_type t) {
     switch (t) {
         case VALUE_NUMBER:
             return "number";
+        case VALUE_INTEGER:
+            return "integer";
         case VALUE_SYMBOL:
             return "symbol";
         case VALUE_ERROR:
@@ -475,6 +777,16 @@ char* get_value_type_name(value_type t) {
             return "s-expr";
         case VALUE_QEXPR:
             return "q-expr";
+        case VALUE_FILE:
+            return "file";
+        case VALUE_FUTURE:
+            return "future";
+        case VALUE_CHANNEL:
+            return "channel";
+        case VALUE_ARRAY:
+            return "array";
+        case VALUE_MAP:
+            return "map";
         default:
             return "unknown";
     }
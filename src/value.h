@@ -2,6 +2,8 @@
 #define VALUE_H_
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 typedef enum {
@@ -13,17 +15,48 @@ typedef enum {
     VALUE_BOOL = 5,
     VALUE_FUNCTION = 6,
     VALUE_SEXPR = 7,
-    VALUE_QEXPR = 8
+    VALUE_QEXPR = 8,
+    VALUE_FILE = 9,
+    VALUE_FUTURE = 10,
+    VALUE_CHANNEL = 11,
+    VALUE_INTEGER = 12,
+    VALUE_ARRAY = 13,
+    VALUE_MAP = 14
 } value_type;
 
 typedef struct value value;
 typedef struct environment environment;
 
+// the handle is shared by the copies of a file value (possibly
+// on different threads, so the count is updated atomically)
+// and the stream is closed when the last one is disposed
+typedef struct value_file {
+    FILE* stream;
+    char* path;
+    char* mode;
+    size_t num_refs;
+} value_file;
+
+// an array is a view of a buffer of doubles, which is shared by the
+// copies and slices of the array and is never written after it's
+// filled in, so the views can be read on any thread without locking
+typedef struct array_buffer array_buffer;
+typedef struct value_array {
+    array_buffer* buffer;
+    double* data;
+    size_t length;
+} value_array;
+
+typedef struct value_future value_future;
+typedef struct value_channel value_channel;
+typedef struct value_map value_map;
+
 typedef value* (*value_fn)(value** args, size_t num_args, char* name, environment* env);
 
 struct value {
     value_type type;
     double number;
+    int64_t integer;
     char* symbol;
     value_fn builtin;
     value* args;
@@ -31,9 +64,15 @@ struct value {
     value** children;
     size_t num_children;
     size_t capacity;
+    value_file* file;
+    value_future* future;
+    value_channel* channel;
+    value_array* array;
+    value_map* map;
 };
 
 value* value_new_number(double number);
+value* value_new_integer(int64_t integer);
 value* value_new_symbol(char* symbol);
 value* value_new_error(char* error, ...);
 value* value_new_error_from_args(char* error, va_list args);
@@ -44,17 +83,28 @@ value* value_new_bool(int truth);
 value* value_new_function(value* function);
 value* value_new_function_builtin(value_fn builtin, char* symbol);
 value* value_new_function_lambda(value* args, value* body);
+value* value_new_file(FILE* stream, char* path, char* mode);
+value* value_new_future(value_future* future);
+value* value_new_channel(value_channel* channel);
+value* value_new_array(value_array* array);
+value* value_new_map(value_map* map);
 value* value_new_sexpr();
 value* value_new_qexpr();
 
 void value_dispose(value* v);
 
 value* value_copy(value* v);
+int value_order(value* v1, value* v2, value** error);
 value* value_compare(value* v1, value* v2);
 value* value_equals(value* v1, value* v2);
 
+int value_is_number(value* v);
+int value_compare_numbers(value* v1, value* v2);
+int value_numbers_equal(value* v1, value* v2);
+
 void value_add_child(value* parent, value* child);
 int value_to_str(value* v, char* buffer);
+void value_print(value* v, FILE* stream);
 value* value_to_bool(value* v);
 
 char* get_value_type_name(value_type t);